@@ -0,0 +1,346 @@
+/*
+ * Copyright (c) 2011, Wouter Coene <wouter@irdc.nl>
+ * 
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Benchmark for the event loop and datagram queues. Besides reporting how
+ * fast things are, this serves as the training workload for profile-guided
+ * builds, so it should exercise the paths that matter in practice.
+ *
+ * usage: bench [-n iterations] [-p port] [loop | queue | queuem]...
+ *
+ * Without -p, the queue benchmarks use a free port picked by the kernel,
+ * so that several runs can go on at once.
+ */
+
+#include <io/loop.h>
+#include <io/event.h>
+#include <io/queue.h>
+#include <io/socket.h>
+#include <io/endpoint.h>
+
+#include <err.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define NPIPES		64
+#define NTIMERS		16
+#define DGRAMSZ		512
+#define BATCHSZ		32
+
+static struct ioloop	*loop;
+static unsigned long	 iterations = 200000,
+			 count;
+static unsigned short	 port;
+
+static double
+now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static void
+report(const char *name, unsigned long n, double start)
+{
+	double t = now() - start;
+
+	printf("%-12s %10lu ops %8.3f s %10.1f ns/op\n", name, n, t,
+	    t * 1e9 / n);
+}
+
+
+/***************************************************************************
+ *** Loop ******************************************************************
+ ***************************************************************************/
+
+static int pipes[NPIPES][2];
+
+static void
+pipe_read(int fd, void *arg)
+{
+	char buf[64];
+	long i = (long) arg;
+
+	/* drain and pass it on to the next pipe */
+	if (read(fd, buf, sizeof(buf)) <= 0)
+		err(1, "read");
+	if (++count < iterations &&
+	    write(pipes[(i + 1) % NPIPES][1], "x", 1) < 0)
+		err(1, "write");
+}
+
+static void
+tick(int num, void *arg)
+{
+	(void) num;
+	(void) arg;
+	count++;
+}
+
+static void
+bench_loop(void)
+{
+	struct ioevent	*rev[NPIPES], *tev[NTIMERS], *dev;
+	struct timeval	 tv;
+	double		 start;
+	long		 i;
+
+	/* a ring of pipes, each passing a token to the next */
+	for (i = 0; i < NPIPES; i++) {
+		if (pipe(pipes[i]) < 0)
+			err(1, "pipe");
+		if ((rev[i] = ioevent_read(pipes[i][0], pipe_read, (void *) i, 0)) == NULL ||
+		    ioevent_attach(rev[i], loop) < 0)
+			err(1, "ioevent_read");
+	}
+
+	/* some timers and a deferred event, to keep those paths warm */
+	for (i = 0; i < NTIMERS; i++) {
+		tv.tv_sec = 0;
+		tv.tv_usec = 100 * (i + 1);
+		if ((tev[i] = ioevent_timer(&tv, tick, NULL, 0)) == NULL ||
+		    ioevent_attach(tev[i], loop) < 0)
+			err(1, "ioevent_timer");
+	}
+	if ((dev = ioevent_defer(tick, NULL, 0)) == NULL ||
+	    ioevent_attach(dev, loop) < 0)
+		err(1, "ioevent_defer");
+
+	/* run */
+	count = 0;
+	start = now();
+	if (write(pipes[0][1], "x", 1) < 0)
+		err(1, "write");
+	while (count < iterations)
+		if (ioloop_once(loop) < 0)
+			err(1, "ioloop_once");
+	report("loop", count, start);
+
+	/* clean up */
+	for (i = 0; i < NPIPES; i++) {
+		ioevent_free(rev[i]);
+		close(pipes[i][0]);
+		close(pipes[i][1]);
+	}
+	for (i = 0; i < NTIMERS; i++)
+		ioevent_free(tev[i]);
+	ioevent_free(dev);
+}
+
+
+/***************************************************************************
+ *** Queue *****************************************************************
+ ***************************************************************************/
+
+static struct ioqueue	*sendq,
+			*recvq;
+static unsigned long	 sent,
+			 received;
+static bool		 batched;
+
+static void
+queue_send(int num, void *arg)
+{
+	static char buf[DGRAMSZ];
+	int i;
+
+	(void) num;
+	(void) arg;
+
+	/* send a batch at once */
+	if (batched) {
+		static struct iobuf	bufs[BATCHSZ];
+		struct iomsg		msgs[BATCHSZ];
+		ssize_t			n;
+
+		if (sent >= iterations || sent - received >= 256)
+			return;
+
+		for (i = 0; i < BATCHSZ; i++) {
+			bufs[i].base = buf;
+			bufs[i].len = sizeof(buf);
+			memset(&msgs[i], '\0', sizeof(msgs[i]));
+			msgs[i].bufs = &bufs[i];
+			msgs[i].nbufs = 1;
+		}
+		if ((n = ioqueue_sendm(sendq, msgs, BATCHSZ)) > 0)
+			sent += n;
+		return;
+	}
+
+	/* send a burst, staying ahead of the receiver only a little */
+	for (i = 0; i < 32 && sent < iterations && sent - received < 256; i++) {
+		if (ioqueue_send(sendq, buf, sizeof(buf), NULL) < 0)
+			break;
+		sent++;
+	}
+}
+
+static void
+queue_recv(int num, void *arg)
+{
+	static char	bufs[BATCHSZ][DGRAMSZ];
+	struct iobuf	iobufs[BATCHSZ];
+	struct iomsg	msgs[BATCHSZ];
+	ssize_t		n;
+	int		i;
+
+	(void) num;
+	(void) arg;
+
+	/* receive a batch at once */
+	if (batched) {
+		for (i = 0; i < BATCHSZ; i++) {
+			iobufs[i].base = bufs[i];
+			iobufs[i].len = DGRAMSZ;
+			memset(&msgs[i], '\0', sizeof(msgs[i]));
+			msgs[i].bufs = &iobufs[i];
+			msgs[i].nbufs = 1;
+		}
+		if ((n = ioqueue_recvm(recvq, msgs, BATCHSZ)) > 0)
+			received += n;
+		return;
+	}
+
+	if (ioqueue_recv(recvq, bufs[0], DGRAMSZ, NULL) > 0)
+		received++;
+}
+
+static int
+reserve_port(struct sockaddr_in *sin)
+{
+	socklen_t	 len = sizeof(*sin);
+	int		 sock, on = 1;
+
+	/* let the kernel pick a port, and hold on to it; the receiving
+	 * queue shares it until this socket is closed */
+	if ((sock = socket(AF_INET, SOCK_DGRAM, 0)) < 0 ||
+	    setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) < 0 ||
+	    bind(sock, (struct sockaddr *) sin, sizeof(*sin)) < 0 ||
+	    getsockname(sock, (struct sockaddr *) sin, &len) < 0)
+		err(1, "reserve_port");
+
+	return sock;
+}
+
+static void
+bench_queue(bool batch)
+{
+	struct ioparam_init	 reuse = { &ioqueue_socket_reuselocal, true };
+	struct sockaddr_in	 sin;
+	struct ioendpoint	*ep;
+	struct ioevent		*sev, *rev;
+	double			 start;
+	int			 hold = -1;
+
+	/* a receiving socket wrapped in a limit queue, and a sender */
+	memset(&sin, '\0', sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_port = htons(port);
+	sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (port == 0)
+		hold = reserve_port(&sin);
+	if ((ep = ioendpoint_alloc_sockaddr((struct sockaddr *) &sin)) == NULL)
+		err(1, "ioendpoint_alloc_sockaddr");
+
+	if ((recvq = ioqueue_alloc_limit(ioqueue_alloc_socket(AF_INET, NULL, ep, &reuse, 1))) == NULL ||
+	    (sendq = ioqueue_alloc_socket(AF_INET, ep, NULL, NULL, 0)) == NULL)
+		err(1, "ioqueue_alloc_socket");
+	if (hold >= 0)
+		close(hold);
+	if (ioqueue_attach(recvq, loop) < 0 || ioqueue_attach(sendq, loop) < 0)
+		err(1, "ioqueue_attach");
+
+	if ((sev = ioqueue_send_event(sendq, queue_send, NULL, 0)) == NULL ||
+	    ioevent_attach(sev, loop) < 0 ||
+	    (rev = ioqueue_recv_event(recvq, queue_recv, NULL, 0)) == NULL ||
+	    ioevent_attach(rev, loop) < 0)
+		err(1, "ioqueue events");
+
+	/* run; datagrams lost on the loopback are simply not counted */
+	batched = batch;
+	sent = received = 0;
+	start = now();
+	while (sent < iterations)
+		if (ioloop_once(loop) < 0)
+			err(1, "ioloop_once");
+	report(batched? "queuem" : "queue", sent, start);
+
+	/* clean up */
+	ioevent_free(sev);
+	ioevent_free(rev);
+	ioqueue_free(sendq);
+	ioqueue_free(recvq);
+	ioendpoint_release(ep);
+}
+
+
+int
+main(int argc, char *argv[])
+{
+	int ch, i;
+
+	while ((ch = getopt(argc, argv, "n:p:")) != -1) {
+		switch (ch) {
+		case 'n':
+			iterations = strtoul(optarg, NULL, 10);
+			break;
+
+		case 'p':
+			port = (unsigned short) strtoul(optarg, NULL, 10);
+			break;
+
+		default:
+			fprintf(stderr, "usage: bench [-n iterations] [-p port] [loop | queue | queuem]...\n");
+			return 1;
+		}
+	}
+	argc -= optind;
+	argv += optind;
+
+	if ((loop = ioloop_alloc(IOEVENT_READ | IOEVENT_WRITE | IOEVENT_TIMER |
+	    IOEVENT_FLAG | IOEVENT_DEFER)) == NULL)
+		err(1, "ioloop_alloc");
+
+	/* run the requested benchmarks, or all of them */
+	for (i = 0; i < argc; i++) {
+		if (strcmp(argv[i], "loop") == 0)
+			bench_loop();
+		else if (strcmp(argv[i], "queue") == 0)
+			bench_queue(false);
+		else if (strcmp(argv[i], "queuem") == 0)
+			bench_queue(true);
+		else
+			errx(1, "unknown benchmark: %s", argv[i]);
+	}
+	if (argc == 0) {
+		bench_loop();
+		bench_queue(false);
+		bench_queue(true);
+	}
+
+	ioloop_free(loop);
+
+	return 0;
+}
@@ -47,6 +47,10 @@ struct ioloop;
 struct ioevent;
 struct ioendpoint;
 struct ioqueue;
+struct iobatch;
+struct iopool;
+struct iopbuf;
+struct iolistener;
 
 enum ioevent_kind;
 enum ioevent_opt;
@@ -67,6 +71,27 @@ enum ioevent_opt;
  */
 typedef void (ioevent_cb_t)(int num, void *arg);
 
+/**
+ * Ready event, as passed to a batch callback function.
+ */
+struct ioevent_ready {
+	struct ioevent	*event;		/**< Event that became ready. */
+	int		 num;		/**< Argument that would have been
+					 *   passed to the event callback. */
+};
+
+/**
+ * Type of a batch callback function, which receives all ready events
+ * sharing a batch at once.
+ *
+ * \param ready	Array of ready events, valid for the duration of the
+ *		call.
+ * \param nready	Number of elements in \a ready; always at least 1.
+ * \param arg	Additional argument passed to iobatch_alloc().
+ */
+typedef void (ioevent_batch_cb_t)(const struct ioevent_ready *ready,
+                                  size_t nready, void *arg);
+
 /**
  * I/O buffer structure for scatter/gather I/O. Should be compatible with
  * struct iovec, but since we'd rather not rely on <sys/uio.h> we provide
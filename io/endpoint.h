@@ -85,6 +85,27 @@ struct ioendpoint_ops {
 	 */
 	int
 	(*compare)(struct ioendpoint *a, struct ioendpoint *b);
+
+	/**
+	 * Hash an endpoint. May be \c NULL, in which case the string
+	 * representation of the endpoint is hashed.
+	 *
+	 * \param endp	Endpoint to hash.
+	 * \returns	A hash value, which is the same for endpoints that
+	 *		are equal.
+	 */
+	uint32_t
+	(*hash)(struct ioendpoint *endp);
+
+	/**
+	 * Prepare an endpoint to be shared between threads, by detaching
+	 * it from anything belonging to the thread that created it. May be
+	 * \c NULL.
+	 *
+	 * \param endp	Endpoint to share.
+	 */
+	void
+	(*share)(struct ioendpoint *endp);
 };
 
 /**
@@ -93,6 +114,7 @@ struct ioendpoint_ops {
 struct ioendpoint {
 	const struct ioendpoint_ops	*ops;	/**< Endpoint operations. */
 	unsigned int			 refs;	/**< Number of references. */
+	bool				 shared;/**< Shared between threads. */
 	char				*str;	/**< String representation. */
 };
 
@@ -123,6 +145,20 @@ ioendpoint_retain(struct ioendpoint *endp);
 IOAPI void
 ioendpoint_release(struct ioendpoint *endp);
 
+/**
+ * Make an endpoint safe to pass to other threads. Endpoints are counted
+ * with plain arithmetic by the thread that created them until they are
+ * shared, and with atomic operations afterwards. Sharing also takes the
+ * endpoint out of the table of any loop that interned it.
+ *
+ * \param endp	Endpoint to share.
+ * \returns	The endpoint operated on.
+ * \note	This must be called by the thread owning the endpoint, before
+ *		handing it over to another thread.
+ */
+IOAPI struct ioendpoint *
+ioendpoint_share(struct ioendpoint *endp);
+
 /**
  * Format an endpoint to a string.
  *
@@ -168,10 +204,23 @@ ioendpoint_equals(struct ioendpoint *a, struct ioendpoint *b);
  * \returns	An integer which is less than zero, equal to zero or greater
  *		than zero if \a a is respectively less than, equal to or
  *		greater than \a b.
+ * \note	Endpoints of different types are compared by converting one
+ *		to the type of the other where possible, and are otherwise
+ *		ordered by type.
  */
 IOAPI int
 ioendpoint_compare(struct ioendpoint *a, struct ioendpoint *b);
 
+/**
+ * Hash an endpoint, for keying state on it.
+ *
+ * \param endp	Endpoint to hash.
+ * \returns	A hash value, which is the same for endpoints that are
+ *		equal.
+ */
+IOAPI uint32_t
+ioendpoint_hash(struct ioendpoint *endp);
+
 IO_END_DECLS
 
 #endif /* IO_ENDPOINT_H */
@@ -79,6 +79,71 @@ IOAPI struct ioevent *
 ioevent_timer(const struct timeval *tv, ioevent_cb_t *cb, void *arg,
               enum ioevent_opt opt);
 
+/**
+ * Change the interval of a timer event. If the event is attached to an I/O
+ * loop, it is re-armed in place to time out \a tv from now, without having
+ * to detach and re-attach it.
+ *
+ * \param event	Timer event to operate on.
+ * \param tv	New interval.
+ * \return	On success, 0 is returned. Otherwise, -1 is returned and \e
+ *		errno is set to indicate the error.
+ */
+IOAPI int
+ioevent_timer_set(struct ioevent *event, const struct timeval *tv);
+
+/**
+ * Set an absolute deadline for a timer event. Unlike intervals, a deadline
+ * does not drift with the latency of the I/O loop. If the event is attached
+ * to an I/O loop, it is re-armed in place; otherwise the deadline takes
+ * effect when the event is attached. Unless the event was allocated with
+ * \c #IOEVENT_ONCE set, it times out periodically afterwards, using its
+ * interval.
+ *
+ * \param event	Timer event to operate on.
+ * \param when	Absolute time, as returned by \e gettimeofday(), at which
+ *		to dispatch the timer.
+ * \return	On success, 0 is returned. Otherwise, -1 is returned and \e
+ *		errno is set to indicate the error.
+ */
+IOAPI int
+ioevent_timer_at(struct ioevent *event, const struct timeval *when);
+
+/**
+ * Allocate an event which is dispatched when no activity has been recorded
+ * for a specified amount of time. Activity is recorded by calling
+ * ioevent_timeout_touch(), which is cheap enough to call for every packet.
+ * Unless the event was allocated with \c #IOEVENT_ONCE set, it is
+ * dispatched again after every further \a tv of inactivity. The event can
+ * be attached to any I/O loop that was allocated with \c #IOEVENT_TIMEOUT
+ * set.
+ *
+ * \param tv	Period of inactivity after which to dispatch the event,
+ *		which must be positive.
+ * \param cb	Callback to invoke when the period has elapsed.
+ * \param arg	Additional argument to pass to \a cb.
+ * \param opt	Event options.
+ * \return	On success, a pointer to a newly allocated event is
+ *		returned. Otherwise, \c NULL is returned and \e errno is set
+ *		to indicate the error.
+ */
+IOAPI struct ioevent *
+ioevent_timeout(const struct timeval *tv, ioevent_cb_t *cb, void *arg,
+                enum ioevent_opt opt);
+
+/**
+ * Record activity for an idle timeout event, postponing its dispatch until
+ * its period has elapsed once more. This records the time of the current
+ * I/O loop iteration and moves the event behind all others with the same
+ * period, in constant time.
+ *
+ * \param event	Attached idle timeout event to operate on.
+ * \return	On success, 0 is returned. Otherwise, -1 is returned and \e
+ *		errno is set to indicate the error.
+ */
+IOAPI int
+ioevent_timeout_touch(struct ioevent *event);
+
 /**
  * Allocate an event which is dispatched when a specified signal is
  * delivered to the current process. The event can be attached to any event
@@ -112,21 +177,107 @@ IOAPI struct ioevent *
 ioevent_child(pid_t child, ioevent_cb_t *cb, void *arg, enum ioevent_opt opt);
 
 /**
- * Allocate an event which is dispatched when a flag is set. The event can
- * be attached to any I/O loop that was allocated with \c #IOEVENT_FLAG
+ * Allocate an event which is dispatched when a flag is raised. The event
+ * can be attached to any I/O loop that was allocated with \c #IOEVENT_FLAG
  * set.
  *
- * \param flag	Pointer to the flag to monitor.
+ * \param flag	Pointer to a flag to test on every iteration of the I/O
+ *		loop, or \c NULL to only dispatch the event when it is
+ *		raised using ioevent_flag_raise().
  * \param cb	Callback to invoke when the flag is set.
  * \param arg	Additional argument to pass to \a cb.
  * \param opt	Event options.
  * \return	On success, a pointer to a newly allocated event is
  *		returned. Otherwise, \c NULL is returned and \e errno is set
  *		to indicate the error.
+ * \note	Testing flags costs time on every iteration of the I/O loop,
+ *		whether they are set or not, and is only supported for
+ *		compatibility. New code should pass \c NULL for \a flag.
  */
 IOAPI struct ioevent *
 ioevent_flag(bool *flag, ioevent_cb_t *cb, void *arg, enum ioevent_opt opt);
 
+/**
+ * Raise a flag event, queueing it for dispatch by the I/O loop it is
+ * attached to. Raising an event that is already queued has no effect.
+ *
+ * \param event	Attached flag event to raise.
+ * \return	On success, 0 is returned. Otherwise, -1 is returned and \e
+ *		errno is set to indicate the error.
+ */
+IOAPI int
+ioevent_flag_raise(struct ioevent *event);
+
+/**
+ * Allocate an event which is dispatched once at the end of every iteration
+ * of an I/O loop in which other events were dispatched, after all of them.
+ * This allows callbacks to stage work, such as output, and have it
+ * completed once per iteration. The event can be attached to any I/O loop
+ * that was allocated with \c #IOEVENT_DEFER set.
+ *
+ * \param cb	Callback to invoke at the end of the iteration.
+ * \param arg	Additional argument to pass to \a cb.
+ * \param opt	Event options.
+ * \return	On success, a pointer to a newly allocated event is
+ *		returned. Otherwise, \c NULL is returned and \e errno is set
+ *		to indicate the error.
+ */
+IOAPI struct ioevent *
+ioevent_defer(ioevent_cb_t *cb, void *arg, enum ioevent_opt opt);
+
+/**
+ * Allocate an event which is dispatched whenever an iteration of an I/O
+ * loop finds no other events ready. While an idle event is attached, the
+ * I/O loop polls for events instead of waiting for them. The event can be
+ * attached to any I/O loop that was allocated with \c #IOEVENT_IDLE set.
+ *
+ * \param cb	Callback to invoke when the I/O loop is idle.
+ * \param arg	Additional argument to pass to \a cb.
+ * \param opt	Event options.
+ * \return	On success, a pointer to a newly allocated event is
+ *		returned. Otherwise, \c NULL is returned and \e errno is set
+ *		to indicate the error.
+ */
+IOAPI struct ioevent *
+ioevent_idle(ioevent_cb_t *cb, void *arg, enum ioevent_opt opt);
+
+/**
+ * Allocate a batch. Read and write events can be bound to a batch using
+ * ioevent_batch(), after which their callbacks are no longer invoked
+ * individually; instead, all bound events that became ready during a pass
+ * of the I/O loop are passed to the batch callback in a single call.
+ *
+ * \param cb	Function to call with the ready events.
+ * \param arg	Additional argument to pass to \a cb.
+ * \return	On success, a pointer to the new batch is returned.
+ *		Otherwise, NULL is returned and \e errno is set to indicate
+ *		the error.
+ */
+IOAPI struct iobatch *
+iobatch_alloc(ioevent_batch_cb_t *cb, void *arg);
+
+/**
+ * Free a batch. No events may be bound to it anymore.
+ *
+ * \param batch	Batch to free.
+ */
+IOAPI void
+iobatch_free(struct iobatch *batch);
+
+/**
+ * Bind an event to a batch, or unbind it. Only read and write events can
+ * be bound, and they can't be allocated with IOEVENT_ONCE or IOEVENT_FREE,
+ * since the batch callback might still refer to them after dispatch.
+ *
+ * \param event	Event to bind.
+ * \param batch	Batch to bind to, or NULL to invoke the event's own
+ *		callback again.
+ * \return	On success, 0 is returned. Otherwise, -1 is returned and
+ *		\e errno is set to indicate the error.
+ */
+IOAPI int
+ioevent_batch(struct ioevent *event, struct iobatch *batch);
+
 /**
  * Free an event. If still attached to an I/O loop, the event is detached.
  *
@@ -0,0 +1,100 @@
+/*
+ * Copyright (c) 2011, Wouter Coene <wouter@irdc.nl>
+ * 
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef IO_HANDLE_H
+#define IO_HANDLE_H
+
+#include <io/defs.h>
+
+IO_BEGIN_DECLS
+
+/**
+ * Handle to an event owned by an I/O loop. Unlike pointers to events,
+ * handles are checked for validity: once the event has been freed, using
+ * its handle fails instead of touching freed memory.
+ */
+typedef uint32_t iohandle_t;
+
+/**
+ * Handle value which never refers to an event.
+ */
+#define IOHANDLE_NONE	((iohandle_t) 0)
+
+/**
+ * Allocate an event monitoring a file for readability, owned by and
+ * attached to an I/O loop. The I/O loop must have been allocated with \c
+ * #IOEVENT_READ set.
+ *
+ * \param loop	I/O loop to allocate the event in.
+ * \param fd	File descriptor to monitor.
+ * \param cb	Callback to invoke when the file descriptor becomes ready
+ *		for reading.
+ * \param arg	Additional argument to pass to \a cb.
+ * \param opt	Event options. If \c #IOEVENT_ONCE is set, the event is
+ *		freed before it is dispatched.
+ * \return	On success, a handle to the newly allocated event is
+ *		returned. Otherwise, \c #IOHANDLE_NONE is returned and \e
+ *		errno is set to indicate the error.
+ */
+IOAPI iohandle_t
+iohandle_read(struct ioloop *loop, int fd, ioevent_cb_t *cb, void *arg,
+              enum ioevent_opt opt);
+
+/**
+ * Allocate an event monitoring a file for writability, owned by and
+ * attached to an I/O loop. The I/O loop must have been allocated with \c
+ * #IOEVENT_WRITE set.
+ *
+ * \param loop	I/O loop to allocate the event in.
+ * \param fd	File descriptor to monitor.
+ * \param cb	Callback to invoke when the file descriptor becomes ready
+ *		for writing.
+ * \param arg	Additional argument to pass to \a cb.
+ * \param opt	Event options. If \c #IOEVENT_ONCE is set, the event is
+ *		freed before it is dispatched.
+ * \return	On success, a handle to the newly allocated event is
+ *		returned. Otherwise, \c #IOHANDLE_NONE is returned and \e
+ *		errno is set to indicate the error.
+ */
+IOAPI iohandle_t
+iohandle_write(struct ioloop *loop, int fd, ioevent_cb_t *cb, void *arg,
+               enum ioevent_opt opt);
+
+/**
+ * Determine if a handle refers to an event in an I/O loop.
+ *
+ * \param loop	I/O loop the event was allocated in.
+ * \param handle	Handle to check.
+ * \return	If \a handle refers to an event that has not been freed, \c
+ *		true is returned, otherwise \c false is returned.
+ */
+IOAPI bool
+iohandle_valid(struct ioloop *loop, iohandle_t handle);
+
+/**
+ * Detach and free an event referred to by a handle.
+ *
+ * \param loop	I/O loop the event was allocated in.
+ * \param handle	Handle to the event to free.
+ * \return	On success, 0 is returned. Otherwise, -1 is returned and \e
+ *		errno is set to indicate the error.
+ */
+IOAPI int
+iohandle_free(struct ioloop *loop, iohandle_t handle);
+
+IO_END_DECLS
+
+#endif /* IO_HANDLE_H */
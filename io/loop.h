@@ -18,6 +18,8 @@
 #define IO_LOOP_H
 
 #include <io/defs.h>
+#include <stdio.h>
+#include <sys/time.h>
 
 IO_BEGIN_DECLS
 
@@ -35,8 +37,16 @@ enum ioevent_kind {
 				 *   allocate using ioevent_signal(). */
 	IOEVENT_CHILD	= 0x10,	/**< Child process terminated;
 				 *   allocate using ioevent_child(). */
-	IOEVENT_FLAG	= 0x20	/**< Flag was set; allocate using
+	IOEVENT_FLAG	= 0x20,	/**< Flag was set; allocate using
 				 *   ioevent_flag(). */
+	IOEVENT_TIMEOUT	= 0x40,	/**< No activity for some time; allocate
+				 *   using ioevent_timeout(). */
+	IOEVENT_DEFER	= 0x80,	/**< Events were dispatched by an
+				 *   iteration of the loop; allocate
+				 *   using ioevent_defer(). */
+	IOEVENT_IDLE	= 0x100	/**< An iteration of the loop found
+				 *   nothing to do; allocate using
+				 *   ioevent_idle(). */
 };
 
 /**
@@ -53,6 +63,24 @@ enum ioevent_kind {
 IOAPI struct ioloop *
 ioloop_alloc(enum ioevent_kind kinds);
 
+/**
+ * Allocate an I/O loop whose memory comes from a particular NUMA node.
+ * The loop structure and its internal tables are carved out of hugepages
+ * where the system provides them, and regular pages otherwise. On systems
+ * without NUMA support, this is equivalent to ioloop_alloc() apart from
+ * the page size.
+ *
+ * \param kinds	Kinds of events that will be attached to the loop.
+ * \param node	NUMA node to allocate memory on, or -1 for the node of
+ *		the CPU the calling thread is running on; call this from
+ *		the thread that will run the loop, after pinning it.
+ * \return	On success, a pointer to the new loop is returned.
+ *		Otherwise, NULL is returned and \e errno is set to indicate
+ *		the error.
+ */
+IOAPI struct ioloop *
+ioloop_alloc_node(enum ioevent_kind kinds, int node);
+
 /**
  * Free a previously-allocated I/O loop.
  *
@@ -71,6 +99,36 @@ ioloop_free(struct ioloop *loop);
 IOAPI int
 ioloop_once(struct ioloop *loop);
 
+/**
+ * Wait at most \a timeout for events and dispatch whatever is ready. This is
+ * meant for embedding an I/O loop in another event loop, usually together
+ * with ioloop_fd().
+ *
+ * \param loop	I/O loop to run.
+ * \param timeout	Maximum time to wait, or NULL to wait until at least
+ *			one event is ready. A zero timeout polls without
+ *			waiting.
+ * \return	On success, the number of events dispatched is returned.
+ *		Otherwise, -1 is returned and \e errno is set to indicate
+ *		the error.
+ */
+IOAPI int
+ioloop_step(struct ioloop *loop, const struct timeval *timeout);
+
+/**
+ * Obtain a file descriptor that becomes readable whenever the I/O loop has
+ * work to do, including when the next timer expires. Once it does, call
+ * ioloop_step() with a zero timeout. Polled flag events are only checked
+ * from ioloop_step() and don't make the descriptor readable.
+ *
+ * \param loop	I/O loop to get the descriptor for.
+ * \return	On success, a file descriptor owned by the loop is returned.
+ *		Otherwise, -1 is returned and \e errno is set to indicate
+ *		the error; ENOTSUP means the backend can't provide one.
+ */
+IOAPI int
+ioloop_fd(struct ioloop *loop);
+
 /**
  * Run an I/O loop until ioloop_break() is called.
  *
@@ -90,6 +148,31 @@ ioloop_run(struct ioloop *loop);
 IOAPI void
 ioloop_break(struct ioloop *loop);
 
+/**
+ * Enable or disable profiling of event callbacks. On average one in \a rate
+ * dispatches is sampled, and the wall-clock and thread CPU time spent in the
+ * callback are attributed to the callback function and event kind.
+ *
+ * \param loop	I/O loop to profile.
+ * \param rate	Average number of dispatches per sample, or 0 to disable
+ *		profiling and discard the data gathered so far.
+ * \return	On success, 0 is returned. Otherwise, -1 is returned and \e
+ *		errno is set to indicate the error.
+ */
+IOAPI int
+ioloop_profile(struct ioloop *loop, unsigned int rate);
+
+/**
+ * Write the profile gathered so far as a table, with the callbacks taking
+ * up the most CPU time first. Times are scaled up by the sampling rate to
+ * estimate the totals.
+ *
+ * \param loop	I/O loop whose profile to write.
+ * \param fp	Stream to write the table to.
+ */
+IOAPI void
+ioloop_profile_dump(struct ioloop *loop, FILE *fp);
+
 IO_END_DECLS
 
 #endif /* IO_LOOP_H */
@@ -0,0 +1,167 @@
+/*
+ * Copyright (c) 2011, Wouter Coene <wouter@irdc.nl>
+ * 
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#ifndef IO_POOL_H
+#define IO_POOL_H
+
+#include <io/defs.h>
+
+IO_BEGIN_DECLS
+
+/**
+ * Pool buffer. Buffers are carved out of fixed-size slabs, which hold the
+ * contents of a single datagram together with room in front of and behind
+ * it, so headers can be added or stripped without copying.
+ */
+struct iopbuf {
+	struct iopool	*pool;		/**< Pool the buffer belongs to. */
+	unsigned int	 refs;		/**< Number of references. */
+	void		*base;		/**< Start of the contents. */
+	size_t		 len;		/**< Length of the contents. */
+};
+
+/**
+ * Allocate a new buffer pool.
+ *
+ * \param loop	If not \c NULL, I/O loop to take memory from, which must
+ *		outlive the pool.
+ * \param size	Size of the contents of a buffer; for receiving, this
+ *		should be at least the maximum datagram size of the queues
+ *		it is used with.
+ * \param headroom	Amount of room to reserve in front of the contents.
+ * \param tailroom	Amount of room to reserve behind the contents.
+ * \returns	On success, a pointer to the newly-allocated pool is
+ *		returned. Otherwise, \c NULL is returned and \e errno is set
+ *		to indicate the error.
+ * \note	The caller is responsible for calling iopool_free() to free
+ *		the pool. Pools are not thread-safe.
+ */
+IOAPI struct iopool *
+iopool_alloc(struct ioloop *loop, size_t size, size_t headroom,
+             size_t tailroom);
+
+/**
+ * Free a buffer pool. Buffers which are still in use remain valid, and
+ * the pool is only released along with the last of them.
+ *
+ * \param pool	Buffer pool to free.
+ */
+IOAPI void
+iopool_free(struct iopool *pool);
+
+/**
+ * Get a buffer from a pool. The contents of the buffer initially span the
+ * full size of the pool's buffers, with the reserved headroom in front.
+ *
+ * \param pool	Buffer pool to get the buffer from.
+ * \returns	On success, a pointer to the buffer is returned. Otherwise,
+ *		\c NULL is returned and \e errno is set to indicate the
+ *		error.
+ * \note	The caller is responsible for calling iopbuf_release() to
+ *		return the buffer to the pool.
+ */
+IOAPI struct iopbuf *
+iopbuf_alloc(struct iopool *pool);
+
+/**
+ * Increase the reference count of a buffer.
+ *
+ * \param buf	Buffer to operate on (which may be \c NULL).
+ * \returns	The buffer operated on.
+ */
+IOAPI struct iopbuf *
+iopbuf_retain(struct iopbuf *buf);
+
+/**
+ * Decrease the reference count of a buffer and return it to its pool if it
+ * reaches zero.
+ *
+ * \param buf	Buffer to operate on (which may be \c NULL).
+ */
+IOAPI void
+iopbuf_release(struct iopbuf *buf);
+
+/**
+ * Determine the amount of room in front of the contents of a buffer.
+ *
+ * \param buf	Buffer to operate on.
+ * \returns	The number of bytes that can be added with iopbuf_push().
+ */
+IOAPI size_t
+iopbuf_headroom(const struct iopbuf *buf);
+
+/**
+ * Determine the amount of room behind the contents of a buffer.
+ *
+ * \param buf	Buffer to operate on.
+ * \returns	The number of bytes that can be added with iopbuf_put().
+ */
+IOAPI size_t
+iopbuf_tailroom(const struct iopbuf *buf);
+
+/**
+ * Add room in front of the contents of a buffer, for instance to prepend a
+ * header.
+ *
+ * \param buf	Buffer to operate on.
+ * \param len	Number of bytes to add.
+ * \returns	On success, a pointer to the added room, which is the new
+ *		start of the contents, is returned. Otherwise, \c NULL is
+ *		returned and \e errno is set to indicate the error.
+ */
+IOAPI void *
+iopbuf_push(struct iopbuf *buf, size_t len);
+
+/**
+ * Strip bytes from the front of the contents of a buffer.
+ *
+ * \param buf	Buffer to operate on.
+ * \param len	Number of bytes to strip.
+ * \returns	On success, a pointer to the new start of the contents is
+ *		returned. Otherwise, \c NULL is returned and \e errno is set
+ *		to indicate the error.
+ */
+IOAPI void *
+iopbuf_pull(struct iopbuf *buf, size_t len);
+
+/**
+ * Add room behind the contents of a buffer, for instance to append a
+ * trailer.
+ *
+ * \param buf	Buffer to operate on.
+ * \param len	Number of bytes to add.
+ * \returns	On success, a pointer to the added room is returned.
+ *		Otherwise, \c NULL is returned and \e errno is set to
+ *		indicate the error.
+ */
+IOAPI void *
+iopbuf_put(struct iopbuf *buf, size_t len);
+
+/**
+ * Strip bytes from the end of the contents of a buffer.
+ *
+ * \param buf	Buffer to operate on.
+ * \param len	Number of bytes to strip.
+ * \returns	On success, 0 is returned. Otherwise, -1 is returned and \e
+ *		errno is set to indicate the error.
+ */
+IOAPI int
+iopbuf_trim(struct iopbuf *buf, size_t len);
+
+IO_END_DECLS
+
+#endif /* IO_POOL_H */
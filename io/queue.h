@@ -21,6 +21,47 @@
 
 IO_BEGIN_DECLS
 
+/**
+ * Datagram, as sent or received in batches by ioqueue_sendm() and
+ * ioqueue_recvm().
+ */
+struct iomsg {
+	const struct iobuf	*bufs;		/**< Buffers holding the datagram,
+						 *   or to place its contents. */
+	size_t			 nbufs;		/**< Number of buffers. */
+	struct ioendpoint	*to;		/**< When sending: if not \c
+						 *   NULL, the endpoint to send
+						 *   the datagram to. */
+	struct ioendpoint	**from;		/**< When receiving: if not \c
+						 *   NULL, where to store the
+						 *   endpoint the datagram was
+						 *   received from. */
+	size_t			 len;		/**< Set to the length of the
+						 *   datagram sent or received. */
+};
+
+/**
+ * Type of a zero-copy send completion function.
+ *
+ * \param copied	Whether the data was copied after all, in which case
+ *			zero-copy sends may not be worth it for this queue.
+ * \param arg		Additional argument passed to ioqueue_send_zc().
+ */
+typedef void (ioqueue_zc_cb_t)(bool copied, void *arg);
+
+/**
+ * Type of a drain function, called for each datagram received by
+ * ioqueue_drain().
+ *
+ * \param buf	Buffer holding the datagram. The function is responsible
+ *		for calling iopbuf_release() to return it to its pool.
+ * \param from	Endpoint the datagram was received from. The function is
+ *		responsible for calling ioendpoint_release() to free it.
+ * \param arg	Additional argument passed to ioqueue_drain().
+ */
+typedef void (ioqueue_drain_cb_t)(struct iopbuf *buf, struct ioendpoint *from,
+                                  void *arg);
+
 /**
  * I/O queue operations.
  */
@@ -117,6 +158,79 @@ struct ioqueue_ops {
 	(*recv)(struct ioqueue *queue, size_t nbufs, const struct iobuf *bufs,
 	        struct ioendpoint **from);
 
+	/**
+	 * Send a batch of datagrams through an I/O queue. May be \c NULL,
+	 * in which case the datagrams are sent one by one.
+	 *
+	 * \param queue	I/O queue to send the datagrams through.
+	 * \param msgs	Array of datagrams to send.
+	 * \param nmsgs	Number of datagrams.
+	 * \returns	On success, the number of datagrams sent is
+	 *		returned, which may be less than \a nmsgs. Otherwise,
+	 *		-1 is returned and \e errno is set to indicate the
+	 *		error.
+	 */
+	ssize_t
+	(*send_batch)(struct ioqueue *queue, struct iomsg *msgs, size_t nmsgs);
+
+	/**
+	 * Receive a batch of datagrams from an I/O queue. May be \c NULL,
+	 * in which case the datagrams are received one by one.
+	 *
+	 * \param queue	I/O queue from which to receive the datagrams.
+	 * \param msgs	Array of datagrams to receive.
+	 * \param nmsgs	Number of datagrams.
+	 * \returns	On success, the number of datagrams received is
+	 *		returned, which may be less than \a nmsgs. Otherwise,
+	 *		-1 is returned and \e errno is set to indicate the
+	 *		error.
+	 */
+	ssize_t
+	(*recv_batch)(struct ioqueue *queue, struct iomsg *msgs, size_t nmsgs);
+
+	/**
+	 * Send a datagram through an I/O queue without copying it. May be
+	 * \c NULL, in which case the datagram is sent normally and \a cb
+	 * is called right away.
+	 *
+	 * \param queue	I/O queue to send the datagram through.
+	 * \param nbufs	Number of buffers.
+	 * \param bufs	Array of buffers holding the datagram to send.
+	 * \param to	If not \c NULL, the endpoint to send the datagram
+	 *		to. Otherwise, the datagram is sent to the default
+	 *		endpoint.
+	 * \param cb	Function to call once the buffers may be reused.
+	 * \param arg	Argument to pass to \a cb.
+	 * \returns	On success, the length of the datagram sent is
+	 *		returned. Otherwise, -1 is returned and \e errno is
+	 *		set to indicate the error, and \a cb isn't called.
+	 */
+	ssize_t
+	(*send_zc)(struct ioqueue *queue, size_t nbufs,
+	           const struct iobuf *bufs, struct ioendpoint *to,
+	           ioqueue_zc_cb_t *cb, void *arg);
+
+	/**
+	 * Receive a datagram from an I/O queue, lending out the endpoint
+	 * it was received from. May be \c NULL, in which case a new
+	 * endpoint is allocated for every datagram.
+	 *
+	 * \param queue	I/O queue from which to receive the datagram.
+	 * \param nbufs	Number of buffers.
+	 * \param bufs	Array of buffers to place the datagram contents.
+	 * \param from	Where to store the endpoint the datagram was
+	 *		received from, which must also be kept in the \e
+	 *		borrowed member of \a queue. The previous one there
+	 *		may be reused if the queue holds the only reference
+	 *		to it.
+	 * \returns	On success, the length of the received datagram is
+	 *		returned. Otherwise, -1 is returned and \e errno is
+	 *		set to indicate the error.
+	 */
+	ssize_t
+	(*recv_borrow)(struct ioqueue *queue, size_t nbufs,
+	               const struct iobuf *bufs, struct ioendpoint **from);
+
 	/**
 	 * Create an I/O event for a I/O queue that is triggered whenever a
 	 * datagram can be sent through that queue.
@@ -179,6 +293,10 @@ struct ioqueue_ops {
  */
 struct ioqueue {
 	const struct ioqueue_ops*ops;		/**< Operations structure. */
+	struct ioendpoint	*borrowed;	/**< Endpoint last lent out by
+						 *   ioqueue_recv_borrow(). */
+	bool			 layered;	/**< Whether datagrams are passed
+						 *   on to another queue. */
 };
 
 /**
@@ -266,6 +384,8 @@ ioqueue_send(struct ioqueue *queue, const void *buf, size_t len,
  * \returns	On success, the length of the datagram sent is returned.
  *		Otherwise, -1 is returned and \e errno is set to indicate
  *		the error.
+ * \note	If the queue is non-blocking and can't take the datagram
+ *		right now, -1 is returned with \e errno set to \c EAGAIN.
  */
 IOAPI ssize_t
 ioqueue_sendv(struct ioqueue *queue, size_t nbufs, const struct iobuf *bufs,
@@ -308,6 +428,29 @@ IOAPI ssize_t
 ioqueue_recva(struct ioqueue *queue, struct iobuf *buf,
               struct ioendpoint **from);
 
+/**
+ * Receive a datagram from an I/O queue into a buffer from a pool. Unlike
+ * ioqueue_recva(), this doesn't need to determine the size of the datagram
+ * first.
+ *
+ * \param queue	I/O queue from which to receive the datagram.
+ * \param pool	Buffer pool to take the buffer from. Datagrams larger
+ *		than the size of its buffers are truncated.
+ * \param buf	Pointer to the location to store the buffer holding the
+ *		datagram. The caller is responsible for calling
+ *		iopbuf_release() to return it to the pool.
+ * \param from	If not \c NULL, a pointer to the location to store the
+ *		endpoint the datagram was received from. The caller is
+ *		responsible for calling ioendpoint_release() to free the
+ *		endpoint.
+ * \returns	On success, the length of the received datagram is returned.
+ *		Otherwise, -1 is returned and \e errno is set to indicate
+ *		the error.
+ */
+IOAPI ssize_t
+ioqueue_recvp(struct ioqueue *queue, struct iopool *pool,
+              struct iopbuf **buf, struct ioendpoint **from);
+
 /**
  * Receive a datagram from an I/O queue.
  *
@@ -321,11 +464,115 @@ ioqueue_recva(struct ioqueue *queue, struct iobuf *buf,
  * \returns	On success, the length of the received datagram is returned.
  *		Otherwise, -1 is returned and \e errno is set to indicate
  *		the error.
+ * \note	If the queue is non-blocking and no datagram is available,
+ *		-1 is returned with \e errno set to \c EAGAIN.
  */
 IOAPI ssize_t
 ioqueue_recvv(struct ioqueue *queue, size_t nbufs, const struct iobuf *bufs,
               struct ioendpoint **from);
 
+/**
+ * Receive a datagram from an I/O queue, lending out the endpoint it was
+ * received from rather than handing over a new one. Where the queue
+ * supports it, a datagram from the same sender as the previous one gets
+ * the same endpoint, and receiving doesn't allocate memory.
+ *
+ * \param queue	I/O queue from which to receive the datagram.
+ * \param nbufs	Number of buffers.
+ * \param bufs	Array of buffers to place the datagram contents.
+ * \param from	Where to store the endpoint the datagram was received
+ *		from. It remains valid until the next call to this
+ *		function on \a queue, or until \a queue is freed; use
+ *		ioendpoint_retain() to keep it for longer.
+ * \returns	On success, the length of the received datagram is returned.
+ *		Otherwise, -1 is returned and \e errno is set to indicate
+ *		the error.
+ */
+IOAPI ssize_t
+ioqueue_recv_borrow(struct ioqueue *queue, size_t nbufs,
+                    const struct iobuf *bufs, struct ioendpoint **from);
+
+/**
+ * Send a batch of datagrams through an I/O queue, using as few system
+ * calls as the queue allows. The \e len member of each datagram sent is
+ * set to its length.
+ *
+ * \param queue	I/O queue through which to send the datagrams.
+ * \param msgs	Array of datagrams to send.
+ * \param nmsgs	Number of datagrams.
+ * \returns	On success, the number of datagrams sent is returned. This
+ *		may be less than \a nmsgs if the queue can't take any more
+ *		right now, or if an error occurred after the first datagram.
+ *		Otherwise, -1 is returned and \e errno is set to indicate
+ *		the error.
+ */
+IOAPI ssize_t
+ioqueue_sendm(struct ioqueue *queue, struct iomsg *msgs, size_t nmsgs);
+
+/**
+ * Receive a batch of datagrams from an I/O queue, using as few system
+ * calls as the queue allows. Waits for the first datagram like
+ * ioqueue_recvv() does, but not for any of the others. The \e len member
+ * of each datagram received is set to its length.
+ *
+ * \param queue	I/O queue from which to receive the datagrams.
+ * \param msgs	Array of datagrams to receive.
+ * \param nmsgs	Number of datagrams.
+ * \returns	On success, the number of datagrams received is returned.
+ *		Otherwise, -1 is returned and \e errno is set to indicate
+ *		the error.
+ */
+IOAPI ssize_t
+ioqueue_recvm(struct ioqueue *queue, struct iomsg *msgs, size_t nmsgs);
+
+/**
+ * Receive the datagrams waiting in a non-blocking I/O queue, up to a
+ * limit, into buffers from a pool. This is meant to be called when the
+ * queue becomes readable: it receives in batches until the queue runs
+ * dry, so one wakeup is amortised over many datagrams, while the limit
+ * keeps a busy queue from starving the rest of the loop.
+ *
+ * \param queue	I/O queue from which to receive the datagrams.
+ * \param pool	Buffer pool to take the buffers from.
+ * \param max	Maximum number of datagrams to receive.
+ * \param cb	Function to call for each datagram received.
+ * \param arg	Additional argument to pass to \a cb.
+ * \returns	On success, the number of datagrams received is returned,
+ *		which is 0 if none were waiting. Otherwise, -1 is returned
+ *		and \e errno is set to indicate the error.
+ * \note	If \a max datagrams were received, more may be waiting; the
+ *		queue remains readable in that case.
+ */
+IOAPI ssize_t
+ioqueue_drain(struct ioqueue *queue, struct iopool *pool, size_t max,
+              ioqueue_drain_cb_t *cb, void *arg);
+
+/**
+ * Send a datagram through an I/O queue without copying its contents,
+ * where the queue supports it. The buffers must be left alone until \a cb
+ * has been called. Queues that can't send without copying call \a cb
+ * before returning.
+ *
+ * \param queue	I/O queue through which to send the datagram.
+ * \param nbufs	Number of buffers.
+ * \param bufs	Array of buffers holding the datagram to send.
+ * \param to	If not \c NULL, the endpoint to send the datagram to.
+ *		Otherwise, the datagram is sent to the default endpoint.
+ * \param cb	Function to call once the buffers may be reused.
+ * \param arg	Argument to pass to \a cb.
+ * \returns	On success, the length of the datagram sent is returned.
+ *		Otherwise, -1 is returned and \e errno is set to indicate
+ *		the error, and \a cb is never called.
+ * \note	Completions are picked up while sending, and as they come
+ *		in while the queue is attached to an I/O loop, which then
+ *		needs to have been allocated with \c #IOEVENT_READ and \c
+ *		#IOEVENT_TIMER set. If the queue is freed first, outstanding
+ *		completions are never reported.
+ */
+IOAPI ssize_t
+ioqueue_send_zc(struct ioqueue *queue, size_t nbufs, const struct iobuf *bufs,
+                struct ioendpoint *to, ioqueue_zc_cb_t *cb, void *arg);
+
 /**
  * Create an I/O event for a I/O queue that is triggered whenever a
  * datagram can be sent through that queue.
@@ -482,6 +729,27 @@ ioqueue_rate_send;
 IOAPI const struct ioparam
 ioqueue_rate_recv;
 
+/**
+ * Allocate a pair of connected in-process I/O queues.
+ *
+ * Datagrams sent on either queue are received on the other, through a
+ * bounded ring in memory rather than the kernel, so that the two can be
+ * used from different threads, each by one thread at a time. Sending and
+ * receiving never block: they fail with \c EAGAIN when the ring is full
+ * or empty, and the queues' events fire when that may have changed. The
+ * queues have no endpoints: sending to one fails with \c EISCONN, and
+ * the sender of a received datagram is always \c NULL.
+ *
+ * \param queues	Where to store the two queues.
+ * \param nslots	Number of datagrams either ring holds, rounded up to
+ *			a power of two.
+ * \param maxsize	Largest datagram that can be sent.
+ * \returns	On success, 0 is returned. Otherwise, -1 is returned and \e
+ *		errno is set to indicate the error.
+ */
+IOAPI int
+ioqueue_alloc_pair(struct ioqueue *queues[2], size_t nslots, size_t maxsize);
+
 IO_END_DECLS
 
 #endif /* IO_QUEUE_H */
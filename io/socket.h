@@ -46,6 +46,34 @@ ioendpoint_socket_ops;
 IOAPI struct ioendpoint *
 ioendpoint_alloc_sockaddr(const struct sockaddr *addr);
 
+/**
+ * Compact IPv4 endpoint operations. Compact endpoints hold only an
+ * address and port (and for IPv6, a scope), and take a fraction of the
+ * memory of a socket endpoint. They convert to and from socket endpoints
+ * with ioendpoint_convert(), and compare, hash and format the same way.
+ */
+IOAPI const struct ioendpoint_ops
+ioendpoint_in4_ops;
+
+/**
+ * Compact IPv6 endpoint operations.
+ */
+IOAPI const struct ioendpoint_ops
+ioendpoint_in6_ops;
+
+/**
+ * Allocate a new compact endpoint holding an IPv4 or IPv6 socket address.
+ *
+ * \param addr	Socket address to create an endpoint for.
+ * \returns	On success, a pointer to a newly-allocated endpoint is
+ *		returned. Otherwise, \c NULL is returned and \e errno is set
+ *		to indicate the error.
+ * \note	The caller is responsible for calling ioendpoint_release()
+ *		to free the endpoint.
+ */
+IOAPI struct ioendpoint *
+ioendpoint_alloc_inet(const struct sockaddr *addr);
+
 /**
  * Convert a socket endpoint to a socket address.
  *
@@ -57,6 +85,24 @@ ioendpoint_alloc_sockaddr(const struct sockaddr *addr);
 IOAPI int
 ioendpoint_sockaddr(struct ioendpoint *endp, struct sockaddr_storage *addr);
 
+/**
+ * Get the canonical socket endpoint for an endpoint. Every I/O loop keeps a
+ * table of the socket endpoints it has handed out, and socket queues
+ * attached to it use the table for the senders of received datagrams.
+ * Sending to a canonical endpoint avoids converting it for every datagram.
+ *
+ * \param loop	I/O loop whose table to use.
+ * \param endp	Endpoint to look up.
+ * \returns	On success, the socket endpoint for the same address as \a
+ *		endp. Otherwise, \c NULL is returned and \e errno is set
+ *		to indicate the error.
+ * \note	The caller is responsible for calling ioendpoint_release()
+ *		to free the endpoint. The table doesn't keep endpoints
+ *		alive.
+ */
+IOAPI struct ioendpoint *
+ioendpoint_intern(struct ioloop *loop, struct ioendpoint *endp);
+
 /**
  * Allocate a new I/O queue communicating over a socket.
  *
@@ -74,6 +120,112 @@ IOAPI struct ioqueue *
 ioqueue_alloc_socket(int af, struct ioendpoint *to, struct ioendpoint *from,
                      const struct ioparam_init *inits, size_t ninits);
 
+/**
+ * Allocate a new I/O queue communicating over a connected stream socket,
+ * such as TCP. Datagrams are carried as frames holding their length,
+ * as a 32-bit number in network byte order, followed by their contents,
+ * so the queue can be used like any other; datagrams are at most 1 MiB.
+ * While attached to an I/O loop that was allocated with \c #IOEVENT_DEFER
+ * set, small datagrams are gathered and written out together at the end of
+ * the loop iteration. Receiving reads as much as is available and parses
+ * datagrams out of that. The send and receive events of the queue are
+ * flag events, so the I/O loop also needs \c #IOEVENT_FLAG, as well as \c
+ * #IOEVENT_READ and \c #IOEVENT_WRITE.
+ *
+ * \param to	Endpoint to connect to. Connecting waits for the
+ *		connection to be established.
+ * \param inits	Initialisation parameters, such as \c
+ *		#ioqueue_socket_nonblock, which takes effect once
+ *		connected.
+ * \param ninits	Number of initialisation parameters.
+ * \returns	On success, a pointer to a new I/O queue is returned.
+ *		Otherwise, \c NULL is returned and \e errno is set to
+ *		indicate the error.
+ * \note	Once the peer has closed the connection, receiving fails with
+ *		\e errno set to \c ECONNRESET, after any complete datagrams
+ *		have been received, and sending fails with \c EPIPE
+ *		rather than raising \c SIGPIPE. Output that the socket
+ *		won't take when the queue is freed is lost; detaching the
+ *		queue first writes it all out.
+ */
+IOAPI struct ioqueue *
+ioqueue_alloc_stream(struct ioendpoint *to, const struct ioparam_init *inits,
+                     size_t ninits);
+
+/**
+ * Type of a listener callback function, called for each connection
+ * accepted.
+ *
+ * \param queue	Stream queue for the connection, as allocated by
+ *		ioqueue_alloc_stream(), which is not attached to any I/O
+ *		loop yet. The function is responsible for calling
+ *		ioqueue_free() to free it.
+ * \param from	Endpoint the connection came from. It remains valid for
+ *		the duration of the call; use ioendpoint_retain() to keep it
+ *		for longer.
+ * \param arg	Additional argument passed to iolistener_alloc().
+ * \note	The function may detach the listener, but not free it: the
+ *		I/O loop is still dispatching the listener's event. Detach
+ *		it, and free it once the callback has returned.
+ */
+typedef void (iolistener_cb_t)(struct ioqueue *queue, struct ioendpoint *from,
+                               void *arg);
+
+/**
+ * Allocate a listener for stream connections. While attached to an I/O
+ * loop that was allocated with \c #IOEVENT_READ set, it accepts waiting
+ * connections whenever any come in, up to a limit per iteration of the
+ * loop, and hands each of them over as a new stream queue. When the
+ * process runs out of file descriptors, the listener stops accepting for
+ * a short while, which takes \c #IOEVENT_TIMER as well.
+ *
+ * \param from	Local endpoint to listen on.
+ * \param reuseport	Whether other listeners may share \a from. To spread
+ *		connections over several I/O loops, give each of them its
+ *		own listener on the same endpoint, with this set; the system
+ *		then balances connections between them.
+ * \param cb	Function to call for each connection accepted.
+ * \param arg	Additional argument to pass to \a cb.
+ * \returns	On success, a pointer to a new listener is returned.
+ *		Otherwise, \c NULL is returned and \e errno is set to
+ *		indicate the error.
+ * \note	The caller is responsible for calling iolistener_free() to
+ *		free the listener.
+ */
+IOAPI struct iolistener *
+iolistener_alloc(struct ioendpoint *from, bool reuseport, iolistener_cb_t *cb,
+                 void *arg);
+
+/**
+ * Free a listener. Connections that were accepted remain open.
+ *
+ * \param listener	Listener to free.
+ */
+IOAPI void
+iolistener_free(struct iolistener *listener);
+
+/**
+ * Attach a listener to an I/O loop.
+ *
+ * \param listener	Listener to attach.
+ * \param loop	I/O loop to attach to.
+ * \returns	On success, 0 is returned. Otherwise, -1 is returned and \e
+ *		errno is set to indicate the error.
+ */
+IOAPI int
+iolistener_attach(struct iolistener *listener, struct ioloop *loop);
+
+/**
+ * Detach a listener from its I/O loop. Connections keep queueing up until
+ * the listener is attached again, or freed.
+ *
+ * \param listener	Listener to detach.
+ * \returns	On success, 0 is returned. Otherwise, -1 is returned and \e
+ *		errno is set to indicate the error.
+ */
+IOAPI int
+iolistener_detach(struct iolistener *listener);
+
 /**
  * Set or clear the flag indicating whether an IPv6 socket should only
  * accept IPv6 traffic.
@@ -118,6 +270,110 @@ ioqueue_socket_mcast_hops;
 IOAPI const struct ioparam
 ioqueue_socket_reuselocal;
 
+/**
+ * Set the segment size for sending. Datagrams passed to ioqueue_send() or
+ * ioqueue_sendv() that are larger than this are split into datagrams of
+ * this size, with only the last one possibly being shorter. Where the
+ * system supports it (UDP generic segmentation offload), the splitting is
+ * done by the kernel or network card; otherwise, it's done by the queue.
+ * The return value of the send is the total length sent.
+ *
+ * \param queue	Queue to operate on.
+ * \param size	Segment size, or 0 to stop splitting datagrams.
+ * \returns	On success, 0 is returned. Otherwise, -1 is returned and \e
+ *		errno is set to indicate the error.
+ */
+#define ioqueue_socket_gso(queue, size)                                     \
+	ioqueue_set((queue), &ioqueue_socket_gso, (size_t) (size))
+
+IOAPI const struct ioparam
+ioqueue_socket_gso;
+
+/**
+ * Ways of handing up datagrams coalesced by receive offload.
+ */
+enum ioqueue_socket_gro {
+	IOQUEUE_SOCKET_GRO_OFF		= 0,	/**< No receive offload. */
+	IOQUEUE_SOCKET_GRO_COALESCE	= 1,	/**< Receive runs of datagrams
+						     as a single buffer. */
+	IOQUEUE_SOCKET_GRO_SPLIT	= 2	/**< Split runs of datagrams
+						     up again in the queue. */
+};
+
+/**
+ * Set how runs of datagrams from the same sender, coalesced by UDP generic
+ * receive offload, are handed up. With \c #IOQUEUE_SOCKET_GRO_COALESCE,
+ * a receive may return several datagrams in one buffer; all but the last
+ * of them have the size returned by \c #ioqueue_socket_segsize. With \c
+ * #IOQUEUE_SOCKET_GRO_SPLIT, the queue receives the whole run in one call
+ * and hands it up a datagram at a time, so only the number of system calls
+ * changes. Where the system has no receive offload, setting either mode
+ * succeeds and datagrams are received one at a time as usual.
+ *
+ * \param queue	Queue to operate on.
+ * \param mode	One of the \c #ioqueue_socket_gro values.
+ * \returns	On success, 0 is returned. Otherwise, -1 is returned and \e
+ *		errno is set to indicate the error.
+ * \note	In split mode, datagrams held by the queue don't make the
+ *		socket readable; after a read event, keep receiving until
+ *		ioqueue_nextsize() returns 0.
+ */
+#define ioqueue_socket_gro(queue, mode)                                     \
+	ioqueue_set((queue), &ioqueue_socket_gro,                           \
+	            (enum ioqueue_socket_gro) (mode))
+
+IOAPI const struct ioparam
+ioqueue_socket_gro;
+
+/**
+ * Set or clear non-blocking mode. By default, queues are non-blocking
+ * while attached to an I/O loop and blocking otherwise; setting this
+ * explicitly overrides that. In non-blocking mode, receiving when no
+ * datagram is available, or sending when the socket has no room, fails
+ * with \e errno set to \c EAGAIN.
+ *
+ * \param queue	Queue to operate on.
+ * \param value	Value of the flag.
+ * \returns	On success, 0 is returned. Otherwise, -1 is returned and \e
+ *		errno is set to indicate the error.
+ */
+#define ioqueue_socket_nonblock(queue, value)                               \
+	ioqueue_set((queue), &ioqueue_socket_nonblock, (value)? true : false)
+
+IOAPI const struct ioparam
+ioqueue_socket_nonblock;
+
+/**
+ * Set or clear path MTU discovery. With path MTU discovery, datagrams are
+ * never fragmented: sending one that doesn't fit the path fails with \e
+ * errno set to \c EMSGSIZE, and ioqueue_maxsize() returns the largest
+ * datagram that fits, as far as the system knows. That is only available
+ * for queues with a remote endpoint; for others, ioqueue_maxsize() is
+ * unaffected.
+ *
+ * \param queue	Queue to operate on.
+ * \param value	Value of the flag.
+ * \returns	On success, 0 is returned. Otherwise, -1 is returned and \e
+ *		errno is set to indicate the error.
+ * \note	The result of ioqueue_maxsize() is cached by the queue until a
+ *		send fails with \c EMSGSIZE, after which the path is asked
+ *		again.
+ */
+#define ioqueue_socket_pmtu(queue, value)                                   \
+	ioqueue_set((queue), &ioqueue_socket_pmtu, (value)? true : false)
+
+IOAPI const struct ioparam
+ioqueue_socket_pmtu;
+
+/**
+ * Segment size of the most recently received buffer. This is only useful
+ * with \c #IOQUEUE_SOCKET_GRO_COALESCE, in which case the buffer holds a
+ * run of datagrams of this size, with only the last one possibly being
+ * shorter. It is read using ioqueue_get() and can't be set.
+ */
+IOAPI const struct ioparam
+ioqueue_socket_segsize;
+
 IO_END_DECLS
 
 #endif /* IO_SOCKET_H */
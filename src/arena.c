@@ -0,0 +1,295 @@
+/*
+ * Copyright (c) 2011, Wouter Coene <wouter@irdc.nl>
+ * 
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "private.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#ifdef __linux__
+# include <sys/syscall.h>
+#endif
+
+#define CHUNKSZ		(2 * 1024 * 1024)	/* size of a hugepage */
+#define MINSHIFT	4			/* smallest class is 16 bytes */
+#define MAXSHIFT	18			/* largest class is 256 KiB */
+
+#ifndef MPOL_PREFERRED
+# define MPOL_PREFERRED	1
+#endif
+
+struct ioarena_chunk {
+	struct ioarena_chunk	*next;		/* next chunk */
+	size_t			 size;		/* size of the mapping */
+};
+
+struct ioarena_block {
+	struct ioarena_block	*next;		/* next free block */
+};
+
+struct ioarena {
+	int			 node;		/* NUMA node, or -1 */
+	struct ioarena_chunk	*chunks;	/* chunks allocated */
+	char			*bump,		/* unused part of last chunk */
+				*end;
+	struct ioarena_block	*free[MAXSHIFT - MINSHIFT + 1];
+};
+
+static unsigned int
+size_class(size_t size)
+{
+	unsigned int shift;
+
+	for (shift = MINSHIFT; ((size_t) 1 << shift) < size; shift++)
+		;
+
+	return shift - MINSHIFT;
+}
+
+static void
+bind_node(void *addr, size_t size, int node)
+{
+#if defined(__linux__) && defined(SYS_mbind)
+	unsigned long mask[4];
+
+	/* prefer the requested node; on machines or kernels without NUMA
+	 * support this simply fails, which is fine */
+	if (node < 0 || (unsigned int) node >= sizeof(mask) * 8)
+		return;
+
+	memset(mask, '\0', sizeof(mask));
+	mask[node / (sizeof(mask[0]) * 8)] |= 1UL << (node % (sizeof(mask[0]) * 8));
+	syscall(SYS_mbind, addr, size, MPOL_PREFERRED, mask, sizeof(mask) * 8, 0);
+#else
+	(void) addr;
+	(void) size;
+	(void) node;
+#endif
+}
+
+static void *
+map(struct ioarena *arena, size_t size)
+{
+	void *p = MAP_FAILED;
+
+	/* try hugepages first, if the size allows */
+#ifdef MAP_HUGETLB
+	if (size % CHUNKSZ == 0)
+		p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+		    MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+#endif
+
+	/* and fall back to regular pages, hinting that transparent
+	 * hugepages would be nice */
+	if (p == MAP_FAILED) {
+		p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+		    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (p == MAP_FAILED)
+			return NULL;
+#ifdef MADV_HUGEPAGE
+		madvise(p, size, MADV_HUGEPAGE);
+#endif
+	}
+
+	/* the pages are only allocated on first touch, so this is early
+	 * enough to influence where they end up */
+	bind_node(p, size, arena->node);
+
+	return p;
+}
+
+static size_t
+map_size(size_t size)
+{
+	size_t pagesz = (size_t) sysconf(_SC_PAGESIZE);
+
+	return (size + pagesz - 1) / pagesz * pagesz;
+}
+
+int
+ioarena_node(void)
+{
+#if defined(__linux__) && defined(SYS_getcpu)
+	unsigned int cpu, node;
+
+	if (syscall(SYS_getcpu, &cpu, &node, NULL) == 0)
+		return (int) node;
+#endif
+
+	return -1;
+}
+
+struct ioarena *
+ioarena_alloc(int node)
+{
+	struct ioarena_chunk	*chunk;
+	struct ioarena		*arena;
+	struct ioarena		 tmp;
+
+	/* map the first chunk, which also holds the arena itself */
+	tmp.node = node;
+	if ((chunk = map(&tmp, CHUNKSZ)) == NULL)
+		return NULL;
+
+	arena = (struct ioarena *) (chunk + 1);
+	memset(arena, '\0', sizeof(*arena));
+	arena->node = node;
+	arena->chunks = chunk;
+	arena->bump = (char *) (arena + 1);
+	arena->end = (char *) chunk + CHUNKSZ;
+
+	chunk->next = NULL;
+	chunk->size = CHUNKSZ;
+
+	return arena;
+}
+
+void
+ioarena_free(struct ioarena *arena)
+{
+	struct ioarena_chunk *chunk, *next;
+
+	/* the arena lives in its first chunk, which stays at the head of
+	 * the list, so don't touch it once that's gone */
+	for (chunk = arena->chunks; chunk != NULL; chunk = next) {
+		next = chunk->next;
+		munmap(chunk, chunk->size);
+	}
+}
+
+void *
+ioarena_get(struct ioarena *arena, size_t size)
+{
+	struct ioarena_chunk	*chunk;
+	struct ioarena_block	*block;
+	unsigned int		 class;
+	size_t			 blocksz;
+	uintptr_t		 p;
+
+	/* large allocations get a mapping of their own */
+	if (size > (size_t) 1 << MAXSHIFT)
+		return map(arena, map_size(size));
+
+	/* take a block off the free list, if there is one */
+	class = size_class(size);
+	if ((block = arena->free[class]) != NULL) {
+		arena->free[class] = block->next;
+		return block;
+	}
+
+	/* carve a new block off the current chunk, starting a new chunk if
+	 * it's exhausted; blocks are aligned on their size, up to a cache
+	 * line */
+	blocksz = (size_t) 1 << (class + MINSHIFT);
+	p = ((uintptr_t) arena->bump + min(blocksz, 64) - 1) &
+	    ~(uintptr_t) (min(blocksz, 64) - 1);
+	if (p + blocksz > (uintptr_t) arena->end) {
+		if ((chunk = map(arena, CHUNKSZ)) == NULL)
+			return NULL;
+
+		chunk->size = CHUNKSZ;
+		chunk->next = arena->chunks->next;
+		arena->chunks->next = chunk;
+
+		p = ((uintptr_t) (chunk + 1) + 63) & ~(uintptr_t) 63;
+		arena->end = (char *) chunk + CHUNKSZ;
+	}
+	arena->bump = (char *) (p + blocksz);
+
+	return (void *) p;
+}
+
+void
+ioarena_put(struct ioarena *arena, void *ptr, size_t size)
+{
+	struct ioarena_block	*block = ptr;
+	unsigned int		 class;
+
+	if (ptr == NULL)
+		return;
+
+	/* large allocations have a mapping of their own */
+	if (size > (size_t) 1 << MAXSHIFT) {
+		munmap(ptr, map_size(size));
+		return;
+	}
+
+	class = size_class(size);
+	block->next = arena->free[class];
+	arena->free[class] = block;
+}
+
+
+/***************************************************************************
+ *** Loop memory ***********************************************************
+ ***************************************************************************/
+
+void *
+iomem_alloc(struct ioloop *loop, size_t size)
+{
+	if (loop->arena == NULL)
+		return malloc(size);
+
+	return ioarena_get(loop->arena, size);
+}
+
+void *
+iomem_zalloc(struct ioloop *loop, size_t size)
+{
+	void *p;
+
+	if (loop->arena == NULL)
+		return calloc(1, size);
+
+	if ((p = ioarena_get(loop->arena, size)) != NULL)
+		memset(p, '\0', size);
+
+	return p;
+}
+
+void *
+iomem_realloc(struct ioloop *loop, void *ptr, size_t oldsz, size_t newsz)
+{
+	void *p;
+
+	if (loop->arena == NULL)
+		return realloc(ptr, newsz);
+
+	/* blocks of the same size class can be reused as they are */
+	if (ptr != NULL && oldsz <= (size_t) 1 << MAXSHIFT &&
+	    newsz <= (size_t) 1 << MAXSHIFT &&
+	    size_class(oldsz) == size_class(newsz))
+		return ptr;
+
+	if ((p = ioarena_get(loop->arena, newsz)) == NULL)
+		return NULL;
+	if (ptr != NULL) {
+		memcpy(p, ptr, min(oldsz, newsz));
+		ioarena_put(loop->arena, ptr, oldsz);
+	}
+
+	return p;
+}
+
+void
+iomem_free(struct ioloop *loop, void *ptr, size_t size)
+{
+	if (loop->arena == NULL)
+		free(ptr);
+	else
+		ioarena_put(loop->arena, ptr, size);
+}
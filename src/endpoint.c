@@ -38,7 +38,13 @@ ioendpoint_alloc(const struct ioendpoint_ops *ops)
 struct ioendpoint *
 ioendpoint_retain(struct ioendpoint *endp)
 {
-	if (endp != NULL)
+	if (endp == NULL)
+		return NULL;
+
+	/* only references across threads pay for atomics */
+	if (endp->shared)
+		atomic_inc(&endp->refs);
+	else
 		endp->refs++;
 
 	return endp;
@@ -47,13 +53,33 @@ ioendpoint_retain(struct ioendpoint *endp)
 void
 ioendpoint_release(struct ioendpoint *endp)
 {
-	if (endp != NULL && --endp->refs == 0) {
+	if (endp == NULL)
+		return;
+
+	if (endp->shared? atomic_dec(&endp->refs) == 0 : --endp->refs == 0) {
 		endp->ops->done(endp);
 		free(endp->str);
 		free(endp);
 	}
 }
 
+struct ioendpoint *
+ioendpoint_share(struct ioendpoint *endp)
+{
+	if (endp->shared)
+		return endp;
+
+	/* the string is formatted on demand, so do it while we're alone */
+	ioendpoint_format(endp);
+
+	if (endp->ops->share != NULL)
+		endp->ops->share(endp);
+
+	endp->shared = true;
+
+	return endp;
+}
+
 const char *
 ioendpoint_format(struct ioendpoint *endp)
 {
@@ -92,7 +118,7 @@ ioendpoint_equals(struct ioendpoint *a, struct ioendpoint *b)
 		return true;
 
 	if (a->ops != b->ops)
-		return false;
+		return ioendpoint_compare(a, b) == 0;
 
 	return a->ops->equals(a, b);
 }
@@ -100,8 +126,47 @@ ioendpoint_equals(struct ioendpoint *a, struct ioendpoint *b)
 int
 ioendpoint_compare(struct ioendpoint *a, struct ioendpoint *b)
 {
+	struct ioendpoint *c;
+	int r;
+
+	if (a->ops == b->ops)
+		return a->ops->compare(a, b);
+
+	/* different types of the same address compare by converting one to
+	 * the other, if either knows how */
+	if ((c = ioendpoint_convert(b, a->ops)) != NULL) {
+		r = a->ops->compare(a, c);
+		ioendpoint_release(c);
+		return r;
+	}
+
+	if ((c = ioendpoint_convert(a, b->ops)) != NULL) {
+		r = b->ops->compare(c, b);
+		ioendpoint_release(c);
+		return r;
+	}
+
+	/* otherwise, order by type */
 	if (a->ops < b->ops) return -1;
 	if (a->ops > b->ops) return 1;
 
-	return a->ops->compare(a, b);
+	return 0;
+}
+
+uint32_t
+ioendpoint_hash(struct ioendpoint *endp)
+{
+	const char *s;
+	uint32_t h;
+
+	if (endp->ops->hash != NULL)
+		return endp->ops->hash(endp);
+
+	/* fall back to the string representation, using FNV-1a */
+	h = 2166136261u;
+	if ((s = ioendpoint_format(endp)) != NULL)
+		while (*s != '\0')
+			h = (h ^ (unsigned char) *(s++)) * 16777619u;
+
+	return h;
 }
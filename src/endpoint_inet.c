@@ -0,0 +1,217 @@
+/*
+ * Copyright (c) 2011, Wouter Coene <wouter@irdc.nl>
+ * 
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#include <io/endpoint.h>
+#include <io/socket.h>
+#include "private_socket.h"
+
+#include <errno.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+/*
+ * Compact endpoints hold just what's needed to address an IPv4 or IPv6
+ * peer, for when there are lots of them to keep track of. Anything else is
+ * done by filling in a socket address on the stack.
+ */
+struct ioendpoint_in4 {
+	struct ioendpoint	 endpoint;
+	struct in_addr		 addr;
+	in_port_t		 port;
+};
+
+struct ioendpoint_in6 {
+	struct ioendpoint	 endpoint;
+	struct in6_addr		 addr;
+	uint32_t		 scope;
+	in_port_t		 port;
+};
+
+static void	 inet_done(struct ioendpoint *);
+static size_t	 inet_format(struct ioendpoint *, char *, size_t);
+static struct ioendpoint
+		*inet_convert(struct ioendpoint *, const struct ioendpoint_ops *);
+static bool	 inet_equals(struct ioendpoint *, struct ioendpoint *);
+static int	 inet_compare(struct ioendpoint *, struct ioendpoint *);
+static uint32_t	 inet_hash(struct ioendpoint *);
+
+const struct ioendpoint_ops
+ioendpoint_in4_ops = {
+	.size		= sizeof(struct ioendpoint_in4),
+	.done		= inet_done,
+	.format		= inet_format,
+	.convert	= inet_convert,
+	.equals		= inet_equals,
+	.compare	= inet_compare,
+	.hash		= inet_hash
+};
+
+const struct ioendpoint_ops
+ioendpoint_in6_ops = {
+	.size		= sizeof(struct ioendpoint_in6),
+	.done		= inet_done,
+	.format		= inet_format,
+	.convert	= inet_convert,
+	.equals		= inet_equals,
+	.compare	= inet_compare,
+	.hash		= inet_hash
+};
+
+int
+ioendpoint_inet_sockaddr(struct ioendpoint *endp,
+                         struct sockaddr_storage *addr, socklen_t *addrlen)
+{
+	if (endp->ops == &ioendpoint_in4_ops) {
+		struct ioendpoint_in4 *in4 = (struct ioendpoint_in4 *) endp;
+		struct sockaddr_in *sin = (struct sockaddr_in *) addr;
+
+		memset(sin, '\0', sizeof(*sin));
+		sin->sin_family = AF_INET;
+		sin->sin_port = in4->port;
+		sin->sin_addr = in4->addr;
+		*addrlen = sizeof(*sin);
+
+		return 0;
+	}
+
+	if (endp->ops == &ioendpoint_in6_ops) {
+		struct ioendpoint_in6 *in6 = (struct ioendpoint_in6 *) endp;
+		struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *) addr;
+
+		memset(sin6, '\0', sizeof(*sin6));
+		sin6->sin6_family = AF_INET6;
+		sin6->sin6_port = in6->port;
+		sin6->sin6_addr = in6->addr;
+		sin6->sin6_scope_id = in6->scope;
+		*addrlen = sizeof(*sin6);
+
+		return 0;
+	}
+
+	return -1;
+}
+
+static void
+inet_done(struct ioendpoint *UNUSED(endp))
+{
+	/* nothing special */
+}
+
+static size_t
+inet_format(struct ioendpoint *endp, char *buf, size_t len)
+{
+	struct sockaddr_storage addr;
+	socklen_t addrlen;
+
+	ioendpoint_inet_sockaddr(endp, &addr, &addrlen);
+
+	return iosockaddr_format(&addr, buf, len);
+}
+
+static struct ioendpoint *
+inet_convert(struct ioendpoint *endp, const struct ioendpoint_ops *ops)
+{
+	struct ioendpoint_socket *sendp;
+
+	/* we only convert to full socket endpoints; they convert onwards */
+	if (ops != &ioendpoint_socket_ops) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	sendp = (struct ioendpoint_socket *)
+	    ioendpoint_alloc(&ioendpoint_socket_ops);
+	if (sendp != NULL)
+		ioendpoint_inet_sockaddr(endp, &sendp->addr, &sendp->addrlen);
+
+	return (struct ioendpoint *) sendp;
+}
+
+static bool
+inet_equals(struct ioendpoint *a, struct ioendpoint *b)
+{
+	return inet_compare(a, b) == 0;
+}
+
+static int
+inet_compare(struct ioendpoint *a, struct ioendpoint *b)
+{
+	struct sockaddr_storage aaddr, baddr;
+	socklen_t addrlen;
+
+	/* order like the equivalent socket endpoints */
+	ioendpoint_inet_sockaddr(a, &aaddr, &addrlen);
+	ioendpoint_inet_sockaddr(b, &baddr, &addrlen);
+
+	return iosockaddr_compare(&aaddr, &baddr);
+}
+
+static uint32_t
+inet_hash(struct ioendpoint *endp)
+{
+	struct sockaddr_storage addr;
+	socklen_t addrlen;
+
+	/* hash like the equivalent socket endpoint */
+	ioendpoint_inet_sockaddr(endp, &addr, &addrlen);
+
+	return iosockaddr_hash(&addr);
+}
+
+struct ioendpoint *
+ioendpoint_alloc_inet(const struct sockaddr *addr)
+{
+	struct ioendpoint *endp;
+
+	switch (addr->sa_family) {
+	case AF_INET: {
+		const struct sockaddr_in *sin = (const struct sockaddr_in *) addr;
+		struct ioendpoint_in4 *in4;
+
+		endp = ioendpoint_alloc(&ioendpoint_in4_ops);
+		if (endp == NULL)
+			return NULL;
+
+		in4 = (struct ioendpoint_in4 *) endp;
+		in4->addr = sin->sin_addr;
+		in4->port = sin->sin_port;
+		break;
+	}
+
+	case AF_INET6: {
+		const struct sockaddr_in6 *sin6 = (const struct sockaddr_in6 *) addr;
+		struct ioendpoint_in6 *in6;
+
+		endp = ioendpoint_alloc(&ioendpoint_in6_ops);
+		if (endp == NULL)
+			return NULL;
+
+		in6 = (struct ioendpoint_in6 *) endp;
+		in6->addr = sin6->sin6_addr;
+		in6->scope = sin6->sin6_scope_id;
+		in6->port = sin6->sin6_port;
+		break;
+	}
+
+	default:
+		errno = EAFNOSUPPORT;
+		return NULL;
+	}
+
+	return endp;
+}
@@ -33,22 +33,33 @@
 
 static void	 socket_done(struct ioendpoint *);
 static size_t	 socket_format(struct ioendpoint *, char *, size_t);
+static struct ioendpoint
+		*socket_convert(struct ioendpoint *, const struct ioendpoint_ops *);
 static bool	 socket_equals(struct ioendpoint *, struct ioendpoint *);
 static int	 socket_compare(struct ioendpoint *, struct ioendpoint *);
+static uint32_t	 socket_hash(struct ioendpoint *);
+static void	 socket_share(struct ioendpoint *);
 
 const struct ioendpoint_ops
 ioendpoint_socket_ops = {
 	.size		= sizeof(struct ioendpoint_socket),
 	.done		= socket_done,
 	.format		= socket_format,
+	.convert	= socket_convert,
 	.equals		= socket_equals,
-	.compare	= socket_compare
+	.compare	= socket_compare,
+	.hash		= socket_hash,
+	.share		= socket_share
 };
 
 static void
-socket_done(struct ioendpoint *UNUSED(endp))
+socket_done(struct ioendpoint *e)
 {
-	/* nothing special */
+	struct ioendpoint_socket *endp = (struct ioendpoint_socket *) e;
+
+	/* leave the table of the loop that interned us */
+	if (endp->intern != NULL)
+		iointern_remove(endp);
 }
 
 static size_t
@@ -56,9 +67,138 @@ socket_format(struct ioendpoint *e, char *buf, size_t len)
 {
 	struct ioendpoint_socket *endp = (struct ioendpoint_socket *) e;
 
+	return iosockaddr_format(&endp->addr, buf, len);
+}
+
+static struct ioendpoint *
+socket_convert(struct ioendpoint *e, const struct ioendpoint_ops *ops)
+{
+	struct ioendpoint_socket *endp = (struct ioendpoint_socket *) e;
+
+	/* only compact endpoints for the same family can hold us */
+	if ((ops == &ioendpoint_in4_ops && endp->addr.ss_family == AF_INET) ||
+	    (ops == &ioendpoint_in6_ops && endp->addr.ss_family == AF_INET6))
+		return ioendpoint_alloc_inet((struct sockaddr *) &endp->addr);
+
+	errno = EINVAL;
+	return NULL;
+}
+
+static bool
+socket_equals(struct ioendpoint *a, struct ioendpoint *b)
+{
+	return socket_compare(a, b) == 0;
+}
+
+static int
+socket_compare(struct ioendpoint *l, struct ioendpoint *r)
+{
+	struct ioendpoint_socket *a = (struct ioendpoint_socket *) l;
+	struct ioendpoint_socket *b = (struct ioendpoint_socket *) r;
+
+	return iosockaddr_compare(&a->addr, &b->addr);
+}
+
+static uint32_t
+socket_hash(struct ioendpoint *e)
+{
+	struct ioendpoint_socket *endp = (struct ioendpoint_socket *) e;
+
+	return iosockaddr_hash(&endp->addr);
+}
+
+static void
+socket_share(struct ioendpoint *e)
+{
+	struct ioendpoint_socket *endp = (struct ioendpoint_socket *) e;
+
+	/* interning tables belong to a single loop */
+	if (endp->intern != NULL)
+		iointern_remove(endp);
+}
+
+static uint32_t
+hash_bytes(uint32_t h, const void *data, size_t len)
+{
+	const unsigned char *p = data;
+
+	/* FNV-1a */
+	while (len-- > 0)
+		h = (h ^ *(p++)) * 16777619u;
+
+	return h;
+}
+
+uint32_t
+iosockaddr_hash(const struct sockaddr_storage *addr)
+{
+	uint32_t h = 2166136261u;
+
+	/* only hash what iosockaddr_compare() looks at */
+	h = hash_bytes(h, &addr->ss_family, sizeof(addr->ss_family));
+	switch (addr->ss_family) {
+#ifdef AF_INET
+	case AF_INET: {
+		const struct sockaddr_in *sin = (const struct sockaddr_in *) addr;
+
+		h = hash_bytes(h, &sin->sin_port, sizeof(sin->sin_port));
+		h = hash_bytes(h, &sin->sin_addr, sizeof(sin->sin_addr));
+		break;
+	}
+#endif
+
+#ifdef AF_INET6
+	case AF_INET6: {
+		const struct sockaddr_in6 *sin6 = (const struct sockaddr_in6 *) addr;
+
+		h = hash_bytes(h, &sin6->sin6_port, sizeof(sin6->sin6_port));
+		h = hash_bytes(h, &sin6->sin6_addr, sizeof(sin6->sin6_addr));
+		break;
+	}
+#endif
+
+#ifdef AF_UNIX
+	case AF_UNIX: {
+		const struct sockaddr_un *sun = (const struct sockaddr_un *) addr;
+
+		h = hash_bytes(h, sun->sun_path, sizeof(sun->sun_path));
+		break;
+	}
+#endif
+	}
+
+	/* FNV is weak in its top bits, which the tables use */
+	h ^= h >> 16;
+	h *= 0x85ebca6bu;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35u;
+	h ^= h >> 16;
+
+	return h;
+}
+
+void
+iosockaddr_trim(struct sockaddr_storage *addr, socklen_t addrlen)
+{
+	/* too short to even hold the family */
+	if (addrlen < offsetof(struct sockaddr_storage, ss_family) +
+	    sizeof(addr->ss_family)) {
+		addr->ss_family = AF_UNSPEC;
+		return;
+	}
+
+#ifdef AF_UNIX
+	if (addr->ss_family == AF_UNIX && addrlen < sizeof(*addr))
+		memset((char *) addr + addrlen, '\0', sizeof(*addr) - addrlen);
+#endif
+}
+
+size_t
+iosockaddr_format(const struct sockaddr_storage *addr, char *buf, size_t len)
+{
 	/* determine required length */
 	if (buf == NULL) {
-		switch (endp->addr.ss_family) {
+		switch (addr->ss_family) {
 #ifdef AF_INET
 		case AF_INET:
 			/* 123.123.123.123:12345 */
@@ -74,7 +214,7 @@ socket_format(struct ioendpoint *e, char *buf, size_t len)
 #ifdef AF_UNIX
 		case AF_UNIX:
 			/* unix:/path */
-			return 5 + nitems(((struct sockaddr_un *) &endp->addr)->sun_path) + 1;
+			return 5 + nitems(((const struct sockaddr_un *) addr)->sun_path) + 1;
 #endif
 		}
 
@@ -82,15 +222,15 @@ socket_format(struct ioendpoint *e, char *buf, size_t len)
 	}
 
 	/* format the address */
-	switch (endp->addr.ss_family) {
+	switch (addr->ss_family) {
 #ifdef AF_INET
 	case AF_INET:
 		/* 123.123.123.123:12345 */
-		inet_ntop(AF_INET, &((struct sockaddr_in *) &endp->addr)->sin_addr,
+		inet_ntop(AF_INET, &((const struct sockaddr_in *) addr)->sin_addr,
 		    buf, len);
 
 		buf += strlen(buf);
-		sprintf(buf, ":%d", ntohs(((struct sockaddr_in *) &endp->addr)->sin_port));
+		sprintf(buf, ":%d", ntohs(((const struct sockaddr_in *) addr)->sin_port));
 		break;
 #endif
 
@@ -98,20 +238,20 @@ socket_format(struct ioendpoint *e, char *buf, size_t len)
 	case AF_INET6:
 		/* [1234:1234:1234:1234:1234:1234:1234:1234]:12345 */
 		*(buf++) = '[';
-		inet_ntop(AF_INET6, &((struct sockaddr_in6 *) &endp->addr)->sin6_addr,
+		inet_ntop(AF_INET6, &((const struct sockaddr_in6 *) addr)->sin6_addr,
 		    buf, --len);
 
 		buf += strlen(buf);
-		sprintf(buf, "]:%d", ntohs(((struct sockaddr_in6 *) &endp->addr)->sin6_port));
+		sprintf(buf, "]:%d", ntohs(((const struct sockaddr_in6 *) addr)->sin6_port));
 		break;
 #endif
 
 #ifdef AF_UNIX
 	case AF_UNIX:
 		memcpy(buf, "unix:", 5);
-		memcpy(buf + 5, ((struct sockaddr_un *) &endp->addr)->sun_path,
-		    nitems(((struct sockaddr_un *) &endp->addr)->sun_path));
-		buf[5 + nitems(((struct sockaddr_un *) &endp->addr)->sun_path)] = '\0';
+		memcpy(buf + 5, ((const struct sockaddr_un *) addr)->sun_path,
+		    nitems(((const struct sockaddr_un *) addr)->sun_path));
+		buf[5 + nitems(((const struct sockaddr_un *) addr)->sun_path)] = '\0';
 		break;
 #endif
 	}
@@ -119,26 +259,18 @@ socket_format(struct ioendpoint *e, char *buf, size_t len)
 	return 0;
 }
 
-static bool
-socket_equals(struct ioendpoint *a, struct ioendpoint *b)
-{
-	return socket_compare(a, b) == 0;
-}
-
-static int
-socket_compare(struct ioendpoint *l, struct ioendpoint *r)
+int
+iosockaddr_compare(const struct sockaddr_storage *a,
+                   const struct sockaddr_storage *b)
 {
-	struct ioendpoint_socket *a = (struct ioendpoint_socket *) l;
-	struct ioendpoint_socket *b = (struct ioendpoint_socket *) r;
-
-	if (a->addr.ss_family < b->addr.ss_family) return -1;
-	if (a->addr.ss_family > b->addr.ss_family) return 1;
+	if (a->ss_family < b->ss_family) return -1;
+	if (a->ss_family > b->ss_family) return 1;
 
-	switch (a->addr.ss_family) {
+	switch (a->ss_family) {
 #ifdef AF_INET
 	case AF_INET: {
-		struct sockaddr_in *asin = (struct sockaddr_in *) &a->addr;
-		struct sockaddr_in *bsin = (struct sockaddr_in *) &b->addr;
+		const struct sockaddr_in *asin = (const struct sockaddr_in *) a;
+		const struct sockaddr_in *bsin = (const struct sockaddr_in *) b;
 
 		if (ntohs(asin->sin_port) < ntohs(bsin->sin_port)) return -1;
 		if (ntohs(asin->sin_port) > ntohs(bsin->sin_port)) return 1;
@@ -150,8 +282,8 @@ socket_compare(struct ioendpoint *l, struct ioendpoint *r)
 
 #ifdef AF_INET6
 	case AF_INET6: {
-		struct sockaddr_in6 *asin6 = (struct sockaddr_in6 *) &a->addr;
-		struct sockaddr_in6 *bsin6 = (struct sockaddr_in6 *) &b->addr;
+		const struct sockaddr_in6 *asin6 = (const struct sockaddr_in6 *) a;
+		const struct sockaddr_in6 *bsin6 = (const struct sockaddr_in6 *) b;
 
 		if (ntohs(asin6->sin6_port) < ntohs(bsin6->sin6_port)) return -1;
 		if (ntohs(asin6->sin6_port) > ntohs(bsin6->sin6_port)) return 1;
@@ -163,8 +295,8 @@ socket_compare(struct ioendpoint *l, struct ioendpoint *r)
 
 #ifdef AF_INET6
 	case AF_UNIX: {
-		struct sockaddr_un *asun = (struct sockaddr_un *) &a->addr;
-		struct sockaddr_un *bsun = (struct sockaddr_un *) &b->addr;
+		const struct sockaddr_un *asun = (const struct sockaddr_un *) a;
+		const struct sockaddr_un *bsun = (const struct sockaddr_un *) b;
 
 		return memcmp(&asun->sun_path, &bsun->sun_path,
 		              sizeof(asun->sun_path));
@@ -0,0 +1,317 @@
+/*
+ * Copyright (c) 2011, Wouter Coene <wouter@irdc.nl>
+ * 
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <io/event.h>
+
+#include "private.h"
+
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+
+#define MAXEVENTS	128
+
+struct ioloop_epoll {
+	struct ioloop		 loop;
+
+	int			 epfd;		/* epoll descriptor */
+	int			 tfd;		/* timer descriptor, if any */
+	unsigned int		 capacity;	/* how much room there is */
+
+	struct ioevent_fd	**readev,	/* attached events */
+				**writeev;
+
+	struct epoll_event	 events[MAXEVENTS];
+};
+
+static int	 init(struct ioloop *);
+static void	 done(struct ioloop *);
+static int	 attach(struct ioloop *, struct ioevent *);
+static int	 detach(struct ioloop *, struct ioevent *);
+static int	 go(struct ioloop *, const struct timeval *);
+static int	 getfd(struct ioloop *);
+static int	 arm(struct ioloop *, const struct timeval *);
+
+const struct iobackend
+iobackend_epoll = {
+	.name	= "epoll",
+	.kinds	= IOEVENT_READ | IOEVENT_WRITE,
+	.loopsz	= sizeof(struct ioloop_epoll),
+	.init	= init,
+	.done	= done,
+	.attach	= attach,
+	.detach	= detach,
+	.go	= go,
+	.fd	= getfd,
+	.arm	= arm
+};
+
+static int
+init(struct ioloop *loop)
+{
+	struct ioloop_epoll *ep = (struct ioloop_epoll *) loop;
+
+	/* initialise */
+	ep->tfd = -1;
+	if ((ep->epfd = epoll_create1(EPOLL_CLOEXEC)) < 0)
+		return -1;
+
+	return 0;
+}
+
+static void
+done(struct ioloop *loop)
+{
+	struct ioloop_epoll *ep = (struct ioloop_epoll *) loop;
+	unsigned int i;
+
+	/* detach all events */
+	for (i = 0; i < ep->capacity; i++) {
+		if (ep->readev[i] != NULL)
+			ioevent_detach((struct ioevent *) ep->readev[i]);
+		if (ep->writeev[i] != NULL)
+			ioevent_detach((struct ioevent *) ep->writeev[i]);
+	}
+
+	/* release everything */
+	iomem_free(loop, ep->readev, ep->capacity * sizeof(*ep->readev));
+	iomem_free(loop, ep->writeev, ep->capacity * sizeof(*ep->writeev));
+	if (ep->tfd >= 0)
+		close(ep->tfd);
+	close(ep->epfd);
+}
+
+static int
+resize_array(struct ioloop *loop, struct ioevent_fd ***ptr,
+             unsigned int oldsz, unsigned int newsz)
+{
+	struct ioevent_fd **new;
+
+	/* resize the array and clear out the new area */
+	if ((new = iomem_realloc(loop, *ptr, oldsz * sizeof(*new),
+	    newsz * sizeof(*new))) == NULL)
+		return -1;
+	memset(new + oldsz, '\0', (newsz - oldsz) * sizeof(*new));
+	*ptr = new;
+
+	return 0;
+}
+
+static int
+resize(struct ioloop_epoll *ep, int fd)
+{
+	unsigned int newsz;
+
+	/* determine the new size */
+	newsz = ep->capacity;
+	if (newsz == 0)
+		newsz = 64;
+	while (newsz <= (unsigned int) fd)
+		newsz *= 2;
+
+	/* resize everything */
+	if (resize_array(&ep->loop, &ep->readev, ep->capacity, newsz) < 0 ||
+	    resize_array(&ep->loop, &ep->writeev, ep->capacity, newsz) < 0)
+		return -1;
+
+	/* and we're done */
+	ep->capacity = newsz;
+
+	return 0;
+}
+
+static uint32_t
+interest(struct ioloop_epoll *ep, int fd)
+{
+	return (ep->readev[fd] != NULL? EPOLLIN : 0) |
+	    (ep->writeev[fd] != NULL? EPOLLOUT : 0);
+}
+
+static int
+attach(struct ioloop *loop, struct ioevent *event)
+{
+	struct ioloop_epoll	*ep = (struct ioloop_epoll *) loop;
+	struct ioevent_fd	*evf = (struct ioevent_fd *) event;
+	struct ioevent_fd	**evs;
+	struct epoll_event	 epev;
+	int			 op;
+
+	/* make room for this event */
+	if ((unsigned int) evf->fd >= ep->capacity &&
+	    resize(ep, evf->fd) < 0)
+		return -1;
+
+	/* determine where to add it */
+	if (event->kind == IOEVENT_READ)
+		evs = ep->readev;
+	else if (event->kind == IOEVENT_WRITE)
+		evs = ep->writeev;
+	else
+		assert(!"can't happen");
+
+	/* check for duplicate attachments */
+	if (evs[evf->fd] != NULL) {
+		errno = EBUSY;
+		return -1;
+	}
+
+	/* both directions share a single registration */
+	op = interest(ep, evf->fd) != 0? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+	evs[evf->fd] = evf;
+
+	memset(&epev, '\0', sizeof(epev));
+	epev.events = interest(ep, evf->fd);
+	epev.data.fd = evf->fd;
+	if (epoll_ctl(ep->epfd, op, evf->fd, &epev) < 0) {
+		evs[evf->fd] = NULL;
+		return -1;
+	}
+
+	return 0;
+}
+
+static int
+detach(struct ioloop *loop, struct ioevent *event)
+{
+	struct ioloop_epoll	*ep = (struct ioloop_epoll *) loop;
+	struct ioevent_fd	*evf = (struct ioevent_fd *) event;
+	struct ioevent_fd	**evs;
+	struct epoll_event	 epev;
+
+	/* determine where to remove it */
+	if (event->kind == IOEVENT_READ)
+		evs = ep->readev;
+	else if (event->kind == IOEVENT_WRITE)
+		evs = ep->writeev;
+	else
+		return 0;
+
+	/* check for invalid detachments */
+	if ((unsigned int) evf->fd >= ep->capacity || evs[evf->fd] != evf) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	/* detach; the descriptor may already have been closed, which
+	 * removes it from the epoll set, so ignore errors */
+	evs[evf->fd] = NULL;
+
+	memset(&epev, '\0', sizeof(epev));
+	epev.events = interest(ep, evf->fd);
+	epev.data.fd = evf->fd;
+	epoll_ctl(ep->epfd, epev.events != 0? EPOLL_CTL_MOD : EPOLL_CTL_DEL,
+	    evf->fd, &epev);
+
+	return 0;
+}
+
+static int
+go(struct ioloop *loop, const struct timeval *timeout)
+{
+	struct ioloop_epoll	*ep = (struct ioloop_epoll *) loop;
+	uint64_t		 ticks;
+	uint32_t		 what;
+	int			 n, i, fd, ms;
+
+	/* convert the timeout to milliseconds, rounding up so we don't
+	 * wake up before the next timer is due */
+	if (timeout != NULL) {
+		if (timeout->tv_sec >= INT_MAX / 1000 - 1)
+			ms = INT_MAX;
+		else
+			ms = timeout->tv_sec * 1000 +
+			    (timeout->tv_usec + 999) / 1000;
+	} else {
+		ms = -1;
+	}
+
+	/* wait for events */
+	n = epoll_wait(ep->epfd, ep->events, MAXEVENTS, ms);
+	if (n < 0)
+		return errno == EINTR? 0 : -1;
+
+	/* process events */
+	for (i = 0; i < n; i++) {
+		fd = ep->events[i].data.fd;
+		what = ep->events[i].events;
+
+		/* the timer only serves to wake up whoever polls us */
+		if (fd == ep->tfd) {
+			while (read(fd, &ticks, sizeof(ticks)) > 0)
+				;
+			continue;
+		}
+
+		/* errors and hangups are reported to both directions, so
+		 * the callbacks get to see them */
+		if ((what & (EPOLLIN | EPOLLERR | EPOLLHUP)) &&
+		    ep->readev[fd] != NULL)
+			ioevent_queue((struct ioevent *) ep->readev[fd]);
+
+		if ((what & (EPOLLOUT | EPOLLERR | EPOLLHUP)) &&
+		    ep->writeev[fd] != NULL)
+			ioevent_queue((struct ioevent *) ep->writeev[fd]);
+	}
+
+	return 0;
+}
+
+static int
+getfd(struct ioloop *loop)
+{
+	struct ioloop_epoll *ep = (struct ioloop_epoll *) loop;
+
+	return ep->epfd;
+}
+
+static int
+arm(struct ioloop *loop, const struct timeval *when)
+{
+	struct ioloop_epoll	*ep = (struct ioloop_epoll *) loop;
+	struct itimerspec	 its;
+	struct epoll_event	 epev;
+
+	/* create the timer on first use */
+	if (ep->tfd < 0) {
+		if ((ep->tfd = timerfd_create(CLOCK_REALTIME,
+		    TFD_NONBLOCK | TFD_CLOEXEC)) < 0)
+			return -1;
+
+		memset(&epev, '\0', sizeof(epev));
+		epev.events = EPOLLIN;
+		epev.data.fd = ep->tfd;
+		if (epoll_ctl(ep->epfd, EPOLL_CTL_ADD, ep->tfd, &epev) < 0) {
+			close(ep->tfd);
+			ep->tfd = -1;
+			return -1;
+		}
+	}
+
+	/* a zero expiry disarms the timer, so a time in the distant past
+	 * is used to fire right away */
+	memset(&its, '\0', sizeof(its));
+	if (when != NULL) {
+		its.it_value.tv_sec = when->tv_sec;
+		its.it_value.tv_nsec = when->tv_usec * 1000;
+		if (its.it_value.tv_sec == 0 && its.it_value.tv_nsec == 0)
+			its.it_value.tv_nsec = 1;
+	}
+
+	return timerfd_settime(ep->tfd, TFD_TIMER_ABSTIME, &its, NULL);
+}
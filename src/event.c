@@ -72,6 +72,27 @@ ioevent_timer(const struct timeval *tv, ioevent_cb_t *cb, void *arg,
 	return (struct ioevent *) event;
 }
 
+struct ioevent *
+ioevent_timeout(const struct timeval *tv, ioevent_cb_t *cb, void *arg,
+                enum ioevent_opt opt)
+{
+	struct ioevent_timeout *event;
+
+	/* a period of nothing would never end */
+	if (tv->tv_sec < 0 || (tv->tv_sec == 0 && tv->tv_usec <= 0)) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	event = calloc(1, sizeof(*event));
+	if (event != NULL) {
+		ioevent_init((struct ioevent *) event, IOEVENT_TIMEOUT, cb, arg, opt);
+		event->tv = *tv;
+	}
+
+	return (struct ioevent *) event;
+}
+
 struct ioevent *
 ioevent_signal(int signal, ioevent_cb_t *cb, void *arg, enum ioevent_opt opt)
 {
@@ -114,6 +135,118 @@ ioevent_flag(bool *flag, ioevent_cb_t *cb, void *arg, enum ioevent_opt opt)
 	return (struct ioevent *) event;
 }
 
+struct ioevent *
+ioevent_flag_owned(struct ioflag_list *owner, bool *flag, ioevent_cb_t *cb,
+                   void *arg, enum ioevent_opt opt)
+{
+	struct ioevent_flag *event;
+
+	event = (struct ioevent_flag *) ioevent_flag(flag, cb, arg, opt);
+	if (event != NULL) {
+		event->owner = owner;
+		LIST_INSERT_LAST(owner, event, owned);
+	}
+
+	return (struct ioevent *) event;
+}
+
+void
+ioflag_list_raise(struct ioflag_list *list)
+{
+	struct ioevent_flag *evf;
+
+	LIST_FOREACH(evf, list, owned)
+		if (ioevent_attached((struct ioevent *) evf))
+			ioevent_queue((struct ioevent *) evf);
+}
+
+void
+ioflag_list_orphan(struct ioflag_list *list)
+{
+	struct ioevent_flag *evf;
+
+	/* the events outlive their owner, so make sure they no longer refer
+	 * to it; they can still be raised explicitly */
+	while ((evf = LIST_FIRST(list, owned)) != NULL) {
+		LIST_REMOVE_FIRST(list, owned);
+		evf->owner = NULL;
+		evf->flag = NULL;
+	}
+}
+
+struct ioevent *
+ioevent_defer(ioevent_cb_t *cb, void *arg, enum ioevent_opt opt)
+{
+	struct ioevent_hook *event;
+
+	event = calloc(1, sizeof(*event));
+	if (event != NULL)
+		ioevent_init((struct ioevent *) event, IOEVENT_DEFER, cb, arg, opt);
+
+	return (struct ioevent *) event;
+}
+
+struct ioevent *
+ioevent_idle(ioevent_cb_t *cb, void *arg, enum ioevent_opt opt)
+{
+	struct ioevent_hook *event;
+
+	event = calloc(1, sizeof(*event));
+	if (event != NULL)
+		ioevent_init((struct ioevent *) event, IOEVENT_IDLE, cb, arg, opt);
+
+	return (struct ioevent *) event;
+}
+
+struct iobatch *
+iobatch_alloc(ioevent_batch_cb_t *cb, void *arg)
+{
+	struct iobatch *batch;
+
+	/* allocate the batch */
+	if ((batch = calloc(1, sizeof(*batch))) == NULL)
+		return NULL;
+
+	batch->cb = cb;
+	batch->arg = arg;
+
+	return batch;
+}
+
+void
+iobatch_free(struct iobatch *batch)
+{
+	assert(batch->num == 0);
+
+	/* don't leave the batch behind for the loop to flush */
+	if (batch->loop != NULL)
+		LIST_REMOVE(&batch->loop->batches, batch, batches);
+
+	free(batch->ready);
+	free(batch);
+}
+
+int
+ioevent_batch(struct ioevent *event, struct iobatch *batch)
+{
+	/* sanity check */
+	if (!(event->kind & (IOEVENT_READ | IOEVENT_WRITE)) ||
+	    (event->opt & (IOEVENT_ONCE | IOEVENT_FREE | IOEVENT_HANDLE))) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	/* an event that's ready on behalf of the old batch stays ready */
+	if (event->batch != NULL && iobatch_forget(event->batch, event)) {
+		event->batch = batch;
+		ioevent_queue(event);
+	} else {
+		event->batch = batch;
+	}
+
+	return 0;
+}
+
 void
 ioevent_free(struct ioevent *event)
 {
@@ -124,5 +257,13 @@ ioevent_free(struct ioevent *event)
 	if (ioevent_attached(event))
 		ioevent_detach(event);
 
+	/* remove from the list of owned flag events */
+	if (event->kind == IOEVENT_FLAG) {
+		struct ioevent_flag *evf = (struct ioevent_flag *) event;
+
+		if (evf->owner != NULL)
+			LIST_REMOVE(evf->owner, evf, owned);
+	}
+
 	free(event);
 }
@@ -0,0 +1,320 @@
+/*
+ * Copyright (c) 2011, Wouter Coene <wouter@irdc.nl>
+ * 
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <io/handle.h>
+#include "private.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define INDEX_MASK	((1u << IOHANDLE_INDEX_BITS) - 1)
+#define GEN_MASK	((1u << (32 - IOHANDLE_INDEX_BITS)) - 1)
+#define WORD_BITS	64
+
+#ifdef __GNUC__
+# define ctz64(x)	((unsigned int) __builtin_ctzll(x))
+#else
+static unsigned int
+ctz64(uint64_t x)
+{
+	unsigned int n;
+
+	for (n = 0; !(x & 1); n++)
+		x >>= 1;
+
+	return n;
+}
+#endif
+
+static int
+grow_array(struct ioloop *loop, void **ptr, size_t o, size_t n, size_t size)
+{
+	void *new;
+
+	/* resize the array and clear out the new area */
+	if ((new = iomem_realloc(loop, *ptr, o * size, n * size)) == NULL)
+		return -1;
+	memset((char *) new + o * size, '\0', (n - o) * size);
+	*ptr = new;
+
+	return 0;
+}
+
+static int
+grow(struct ioloop *loop, struct iohandles *h)
+{
+	unsigned int o = h->max, n;
+
+	/* determine the new size */
+	n = o != 0? o * 2 : IOHANDLE_CHUNK;
+	if (n > INDEX_MASK + 1) {
+		errno = ENOMEM;
+		return -1;
+	}
+
+	/* resize everything */
+	if (grow_array(loop, (void **) &h->kind, o, n, sizeof(*h->kind)) < 0 ||
+	    grow_array(loop, (void **) &h->opt, o, n, sizeof(*h->opt)) < 0 ||
+	    grow_array(loop, (void **) &h->fd, o, n, sizeof(*h->fd)) < 0 ||
+	    grow_array(loop, (void **) &h->cb, o, n, sizeof(*h->cb)) < 0 ||
+	    grow_array(loop, (void **) &h->arg, o, n, sizeof(*h->arg)) < 0 ||
+	    grow_array(loop, (void **) &h->queued, o / WORD_BITS, n / WORD_BITS, sizeof(*h->queued)) < 0 ||
+	    grow_array(loop, (void **) &h->gen, o, n, sizeof(*h->gen)) < 0 ||
+	    grow_array(loop, (void **) &h->free, o, n, sizeof(*h->free)) < 0 ||
+	    grow_array(loop, (void **) &h->chunks, o / IOHANDLE_CHUNK, n / IOHANDLE_CHUNK, sizeof(*h->chunks)) < 0)
+		return -1;
+
+	/* and we're done */
+	h->max = n;
+
+	return 0;
+}
+
+static struct iohandle_event *
+event_at(struct iohandles *h, uint32_t index)
+{
+	return &h->chunks[index / IOHANDLE_CHUNK][index % IOHANDLE_CHUNK];
+}
+
+static uint32_t
+lookup(struct ioloop *loop, iohandle_t handle)
+{
+	struct iohandles *h = loop->handles;
+	uint32_t index = handle & INDEX_MASK;
+
+	/* the generation number must match, or the event was freed */
+	if (h == NULL || index >= h->num || h->kind[index] == 0 ||
+	    h->gen[index] != handle >> IOHANDLE_INDEX_BITS) {
+		errno = EINVAL;
+		return UINT32_MAX;
+	}
+
+	return index;
+}
+
+static void
+release(struct ioloop *loop, uint32_t index)
+{
+	struct iohandles	*h = loop->handles;
+	struct iohandle_event	*ev = event_at(h, index);
+
+	/* detach the event from the backend */
+	if (ioevent_attached((struct ioevent *) ev))
+		ioevent_detach((struct ioevent *) ev);
+
+	/* bump the generation number, which invalidates the handle */
+	h->kind[index] = 0;
+	h->gen[index] = (h->gen[index] + 1) & GEN_MASK;
+	if (h->gen[index] == 0)
+		h->gen[index] = 1;
+	h->free[h->nfree++] = index;
+}
+
+static iohandle_t
+alloc(struct ioloop *loop, enum ioevent_kind kind, int fd, ioevent_cb_t *cb,
+      void *arg, enum ioevent_opt opt)
+{
+	struct iohandles	*h;
+	struct iohandle_event	*ev;
+	uint32_t		 index;
+
+	/* allocate the handle table on first use */
+	if (loop->handles == NULL &&
+	    (loop->handles = iomem_zalloc(loop, sizeof(*loop->handles))) == NULL)
+		return IOHANDLE_NONE;
+	h = loop->handles;
+
+	/* find a free index */
+	if (h->nfree != 0) {
+		index = h->free[--h->nfree];
+	} else {
+		if (h->num == h->max && grow(loop, h) < 0)
+			return IOHANDLE_NONE;
+
+		if (h->chunks[h->num / IOHANDLE_CHUNK] == NULL &&
+		    (h->chunks[h->num / IOHANDLE_CHUNK] =
+		     iomem_zalloc(loop, IOHANDLE_CHUNK * sizeof(**h->chunks))) == NULL)
+			return IOHANDLE_NONE;
+
+		index = h->num++;
+		h->gen[index] = 1;
+	}
+
+	/* set up the event seen by the backend; one-shot events are
+	 * handled by us, and we free the event ourselves */
+	ev = event_at(h, index);
+	memset(ev, '\0', sizeof(*ev));
+	ioevent_init((struct ioevent *) ev, kind, cb, arg,
+	    (opt & ~(IOEVENT_ONCE | IOEVENT_FREE)) | IOEVENT_HANDLE);
+	ev->event.fd = fd;
+	ev->index = index;
+
+	if (ioevent_attach((struct ioevent *) ev, loop) < 0) {
+		h->free[h->nfree++] = index;
+		return IOHANDLE_NONE;
+	}
+
+	/* fill in the table */
+	h->kind[index] = kind;
+	h->opt[index] = opt;
+	h->fd[index] = fd;
+	h->cb[index] = cb;
+	h->arg[index] = arg;
+
+	return (iohandle_t) h->gen[index] << IOHANDLE_INDEX_BITS | index;
+}
+
+void
+iohandle_queue(struct ioloop *loop, struct ioevent *event)
+{
+	struct iohandles	*h = loop->handles;
+	uint32_t		 index = ((struct iohandle_event *) event)->index;
+	unsigned int		 word = index / WORD_BITS;
+	uint64_t		 bit = (uint64_t) 1 << (index % WORD_BITS);
+
+	/* sanity check: event already queued? */
+	if (h->queued[word] & bit)
+		return;
+
+	h->queued[word] |= bit;
+
+	/* keep track of the range of words to scan */
+	if (h->npending++ == 0) {
+		h->lo = h->hi = word;
+	} else {
+		h->lo = min(h->lo, word);
+		h->hi = max(h->hi, word);
+	}
+}
+
+void
+iohandle_dequeue(struct ioloop *loop, struct ioevent *event)
+{
+	struct iohandles	*h = loop->handles;
+	uint32_t		 index = ((struct iohandle_event *) event)->index;
+	unsigned int		 word = index / WORD_BITS;
+	uint64_t		 bit = (uint64_t) 1 << (index % WORD_BITS);
+
+	/* sanity check: event not queued? */
+	if (!(h->queued[word] & bit))
+		return;
+
+	h->queued[word] &= ~bit;
+	h->npending--;
+}
+
+unsigned int
+iohandle_dispatch(struct ioloop *loop)
+{
+	struct iohandles	*h = loop->handles;
+	unsigned int		 n, word;
+	uint32_t		 index;
+	uint64_t		 bits;
+	ioevent_cb_t		*cb;
+	void			*arg;
+	int			 fd;
+	enum ioevent_kind	 kind;
+
+	/* scan the bitmap of queued events; callbacks may queue more
+	 * events, so re-read the bitmap after every one */
+	n = 0;
+	for (word = h->lo; h->npending != 0 && word <= h->hi; word++) {
+		while ((bits = h->queued[word]) != 0) {
+			index = word * WORD_BITS + ctz64(bits);
+			h->queued[word] = bits & (bits - 1);
+			h->npending--;
+
+			kind = h->kind[index];
+			cb = h->cb[index];
+			arg = h->arg[index];
+			fd = h->fd[index];
+
+			/* one-shot events are freed before dispatch, so
+			 * the callback may allocate a new one */
+			if (h->opt[index] & IOEVENT_ONCE)
+				release(loop, index);
+
+			ioevent_call(loop, kind, cb, fd, arg);
+			n++;
+		}
+	}
+
+	return n;
+}
+
+void
+iohandle_done(struct ioloop *loop)
+{
+	struct iohandles	*h = loop->handles;
+	unsigned int		 i;
+
+	if (h == NULL)
+		return;
+
+	/* release all events */
+	for (i = 0; i < h->num; i++)
+		if (h->kind[i] != 0)
+			release(loop, i);
+
+	/* release arrays */
+	for (i = 0; i < h->max / IOHANDLE_CHUNK; i++)
+		iomem_free(loop, h->chunks[i], IOHANDLE_CHUNK * sizeof(**h->chunks));
+	iomem_free(loop, h->chunks, h->max / IOHANDLE_CHUNK * sizeof(*h->chunks));
+	iomem_free(loop, h->kind, h->max * sizeof(*h->kind));
+	iomem_free(loop, h->opt, h->max * sizeof(*h->opt));
+	iomem_free(loop, h->fd, h->max * sizeof(*h->fd));
+	iomem_free(loop, h->cb, h->max * sizeof(*h->cb));
+	iomem_free(loop, h->arg, h->max * sizeof(*h->arg));
+	iomem_free(loop, h->queued, h->max / WORD_BITS * sizeof(*h->queued));
+	iomem_free(loop, h->gen, h->max * sizeof(*h->gen));
+	iomem_free(loop, h->free, h->max * sizeof(*h->free));
+	iomem_free(loop, h, sizeof(*h));
+
+	loop->handles = NULL;
+}
+
+iohandle_t
+iohandle_read(struct ioloop *loop, int fd, ioevent_cb_t *cb, void *arg,
+              enum ioevent_opt opt)
+{
+	return alloc(loop, IOEVENT_READ, fd, cb, arg, opt);
+}
+
+iohandle_t
+iohandle_write(struct ioloop *loop, int fd, ioevent_cb_t *cb, void *arg,
+               enum ioevent_opt opt)
+{
+	return alloc(loop, IOEVENT_WRITE, fd, cb, arg, opt);
+}
+
+bool
+iohandle_valid(struct ioloop *loop, iohandle_t handle)
+{
+	return lookup(loop, handle) != UINT32_MAX;
+}
+
+int
+iohandle_free(struct ioloop *loop, iohandle_t handle)
+{
+	uint32_t index;
+
+	if ((index = lookup(loop, handle)) == UINT32_MAX)
+		return -1;
+
+	release(loop, index);
+
+	return 0;
+}
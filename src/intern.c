@@ -0,0 +1,283 @@
+/*
+ * Copyright (c) 2011, Wouter Coene <wouter@irdc.nl>
+ * 
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#include <io/endpoint.h>
+#include <io/socket.h>
+#include "private_socket.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __SSE2__
+# include <emmintrin.h>
+#endif
+
+/*
+ * The table is an open-addressed hash table in the style of Abseil's
+ * Swiss tables: a control byte per slot holds 7 bits of the hash of the
+ * endpoint in it, or marks the slot as empty or dead, and a group of 16
+ * control bytes is checked at once. The first group is mirrored past the
+ * end so that groups can straddle it.
+ */
+#define GROUP		16		/* slots checked at once */
+#define CTRL_EMPTY	0x80		/* slot never used */
+#define CTRL_DEAD	0xfe		/* slot used, then removed */
+
+#define h1(hash)	((size_t) (hash))
+#define h2(hash)	((uint8_t) ((hash) >> 25))
+
+struct iointern {
+	struct ioloop		 *loop;		/* loop we belong to */
+	uint8_t			 *ctrl;		/* control bytes */
+	struct ioendpoint_socket **slots;	/* endpoints */
+	size_t			  cap,		/* number of slots */
+				  used,		/* number of endpoints */
+				  dead;		/* number of dead slots */
+};
+
+#ifdef __GNUC__
+# define ctz32(x)	((unsigned int) __builtin_ctz(x))
+#else
+static unsigned int
+ctz32(uint32_t x)
+{
+	unsigned int n;
+
+	for (n = 0; !(x & 1); n++)
+		x >>= 1;
+
+	return n;
+}
+#endif
+
+static uint32_t
+match(const uint8_t *group, uint8_t c)
+{
+#ifdef __SSE2__
+	__m128i g = _mm_loadu_si128((const __m128i *) group);
+
+	return (uint32_t) _mm_movemask_epi8(
+	    _mm_cmpeq_epi8(g, _mm_set1_epi8((char) c)));
+#else
+	uint32_t mask = 0;
+	unsigned int i;
+
+	for (i = 0; i < GROUP; i++)
+		if (group[i] == c)
+			mask |= 1u << i;
+
+	return mask;
+#endif
+}
+
+static void
+set_ctrl(struct iointern *t, size_t i, uint8_t c)
+{
+	t->ctrl[i] = c;
+	if (i < GROUP)
+		t->ctrl[t->cap + i] = c;
+}
+
+static size_t
+find_free(struct iointern *t, uint32_t hash)
+{
+	size_t pos, step;
+	uint32_t mask;
+
+	/* triangular probing visits every group once */
+	for (pos = h1(hash) & (t->cap - 1), step = GROUP; ;
+	     pos = (pos + step) & (t->cap - 1), step += GROUP) {
+		mask = match(t->ctrl + pos, CTRL_EMPTY) |
+		    match(t->ctrl + pos, CTRL_DEAD);
+		if (mask != 0)
+			return (pos + ctz32(mask)) & (t->cap - 1);
+	}
+}
+
+static int
+resize(struct iointern *t, size_t cap)
+{
+	struct ioendpoint_socket **slots = t->slots;
+	uint8_t *ctrl = t->ctrl;
+	size_t i, j, oldcap = t->cap;
+
+	/* allocate the new arrays */
+	t->slots = iomem_alloc(t->loop, cap * sizeof(*t->slots));
+	t->ctrl = iomem_alloc(t->loop, cap + GROUP);
+	if (t->slots == NULL || t->ctrl == NULL) {
+		iomem_free(t->loop, t->slots, cap * sizeof(*t->slots));
+		iomem_free(t->loop, t->ctrl, cap + GROUP);
+		t->slots = slots;
+		t->ctrl = ctrl;
+		return -1;
+	}
+	memset(t->ctrl, CTRL_EMPTY, cap + GROUP);
+	t->cap = cap;
+	t->dead = 0;
+
+	/* move everything over, leaving the dead behind */
+	for (i = 0; i < oldcap; i++) {
+		if (ctrl[i] & CTRL_EMPTY)
+			continue;
+
+		j = find_free(t, slots[i]->hash);
+		set_ctrl(t, j, h2(slots[i]->hash));
+		t->slots[j] = slots[i];
+	}
+
+	iomem_free(t->loop, slots, oldcap * sizeof(*slots));
+	iomem_free(t->loop, ctrl, oldcap + GROUP);
+
+	return 0;
+}
+
+struct ioendpoint_socket *
+iointern_get(struct ioloop *loop, const struct sockaddr_storage *addr,
+             socklen_t addrlen)
+{
+	struct iointern			*t;
+	struct ioendpoint_socket	*endp;
+	uint32_t			 hash, mask;
+	size_t				 pos, step, i;
+
+	/* set up the table when first needed */
+	if ((t = loop->intern) == NULL) {
+		t = iomem_zalloc(loop, sizeof(*t));
+		if (t == NULL)
+			return NULL;
+		t->loop = loop;
+		if (resize(t, GROUP) < 0) {
+			iomem_free(loop, t, sizeof(*t));
+			return NULL;
+		}
+		loop->intern = t;
+	}
+
+	/* look for the address, stopping at the first group with room */
+	hash = iosockaddr_hash(addr);
+	for (pos = h1(hash) & (t->cap - 1), step = GROUP; ;
+	     pos = (pos + step) & (t->cap - 1), step += GROUP) {
+		for (mask = match(t->ctrl + pos, h2(hash)); mask != 0;
+		     mask &= mask - 1) {
+			i = (pos + ctz32(mask)) & (t->cap - 1);
+			endp = t->slots[i];
+			if (endp->hash == hash &&
+			    iosockaddr_compare(&endp->addr, addr) == 0)
+				return (struct ioendpoint_socket *)
+				    ioendpoint_retain(&endp->endpoint);
+		}
+
+		if (match(t->ctrl + pos, CTRL_EMPTY) != 0)
+			break;
+	}
+
+	/* keep the load below 7/8, counting the dead */
+	if ((t->used + t->dead + 1) * 8 > t->cap * 7 &&
+	    resize(t, t->used * 2 >= t->cap? t->cap * 2 : t->cap) < 0)
+		return NULL;
+
+	/* create a new endpoint */
+	endp = (struct ioendpoint_socket *)
+	    ioendpoint_alloc(&ioendpoint_socket_ops);
+	if (endp == NULL)
+		return NULL;
+	memcpy(&endp->addr, addr, addrlen);
+	endp->addrlen = addrlen;
+	endp->hash = hash;
+	endp->intern = t;
+
+	/* and add it */
+	i = find_free(t, hash);
+	if (t->ctrl[i] == CTRL_DEAD)
+		t->dead--;
+	set_ctrl(t, i, h2(hash));
+	t->slots[i] = endp;
+	t->used++;
+
+	return endp;
+}
+
+struct ioendpoint *
+ioendpoint_intern(struct ioloop *loop, struct ioendpoint *e)
+{
+	struct ioendpoint_socket *endp, *canon;
+
+	/* already canonical */
+	endp = (struct ioendpoint_socket *) e;
+	if (e->ops == &ioendpoint_socket_ops && endp->intern == loop->intern &&
+	    endp->intern != NULL)
+		return ioendpoint_retain(e);
+
+	/* look it up by its socket address */
+	endp = (struct ioendpoint_socket *)
+	    ioendpoint_convert(e, &ioendpoint_socket_ops);
+	if (endp == NULL) {
+		errno = EAFNOSUPPORT;
+		return NULL;
+	}
+
+	canon = iointern_get(loop, &endp->addr, endp->addrlen);
+	ioendpoint_release((struct ioendpoint *) endp);
+
+	return (struct ioendpoint *) canon;
+}
+
+void
+iointern_remove(struct ioendpoint_socket *endp)
+{
+	struct iointern *t = endp->intern;
+	size_t pos, step, i;
+	uint32_t mask;
+
+	for (pos = h1(endp->hash) & (t->cap - 1), step = GROUP; ;
+	     pos = (pos + step) & (t->cap - 1), step += GROUP) {
+		for (mask = match(t->ctrl + pos, h2(endp->hash)); mask != 0;
+		     mask &= mask - 1) {
+			i = (pos + ctz32(mask)) & (t->cap - 1);
+			if (t->slots[i] != endp)
+				continue;
+
+			set_ctrl(t, i, CTRL_DEAD);
+			t->used--;
+			t->dead++;
+			endp->intern = NULL;
+			return;
+		}
+
+		assert(match(t->ctrl + pos, CTRL_EMPTY) == 0);
+	}
+}
+
+void
+iointern_done(struct ioloop *loop)
+{
+	struct iointern *t = loop->intern;
+	size_t i;
+
+	if (t == NULL)
+		return;
+
+	/* endpoints outlive the loop; cut them loose */
+	for (i = 0; i < t->cap; i++)
+		if (!(t->ctrl[i] & CTRL_EMPTY))
+			t->slots[i]->intern = NULL;
+
+	iomem_free(loop, t->slots, t->cap * sizeof(*t->slots));
+	iomem_free(loop, t->ctrl, t->cap + GROUP);
+	iomem_free(loop, t, sizeof(*t));
+	loop->intern = NULL;
+}
@@ -0,0 +1,218 @@
+/*
+ * Copyright (c) 2011, Wouter Coene <wouter@irdc.nl>
+ * 
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+/* for accept4() */
+#define _GNU_SOURCE
+
+#include <io/event.h>
+#include <io/socket.h>
+#include "private_socket.h"
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#define ACCEPTMAX	64		/* connections accepted per wakeup */
+#define ACCEPTWAIT	100000		/* us to back off when out of fds */
+
+struct iolistener {
+	int			 sock;
+	struct ioloop		*loop;		/* I/O loop we're attached to */
+	struct ioevent		*event,		/* listening socket is readable */
+				*retry;		/* back-off timer */
+	iolistener_cb_t		*cb;		/* callback function */
+	void			*arg;		/* callback argument */
+};
+
+static void	 listener_readable(int, void *);
+static void	 listener_retry(int, void *);
+
+struct iolistener *
+iolistener_alloc(struct ioendpoint *f, bool reuseport, iolistener_cb_t *cb,
+                 void *arg)
+{
+	struct iolistener		*listener;
+	struct ioendpoint_socket	*from;
+	struct timeval			 tv = { 0, ACCEPTWAIT };
+	int				 v;
+
+	/* convert endpoint to something we can deal with */
+	from = (struct ioendpoint_socket *)
+	    ioendpoint_convert(f, &ioendpoint_socket_ops);
+	if (from == NULL) {
+		errno = EAFNOSUPPORT;
+		return NULL;
+	}
+
+	/* allocate a new listener and initialise it */
+	listener = calloc(1, sizeof(*listener));
+	if (listener == NULL)
+		goto error;
+
+	listener->cb = cb;
+	listener->arg = arg;
+
+	/* create the socket; it's drained until it runs dry, so it must not
+	 * block */
+	listener->sock = socket(from->addr.ss_family,
+	    SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (listener->sock < 0)
+		goto error;
+
+	v = 1;
+	if (setsockopt(listener->sock, SOL_SOCKET, SO_REUSEADDR,
+	               &v, sizeof(v)) < 0)
+		goto error;
+
+	/* several listeners, for instance one per loop, may share the
+	 * address, with the system spreading connections over them */
+	if (reuseport) {
+#ifdef SO_REUSEPORT
+		if (setsockopt(listener->sock, SOL_SOCKET, SO_REUSEPORT,
+		               &v, sizeof(v)) < 0)
+			goto error;
+#else
+		errno = ENOTSUP;
+		goto error;
+#endif
+	}
+
+	if (bind(listener->sock, (struct sockaddr *) &from->addr,
+	         from->addrlen) < 0 ||
+	    listen(listener->sock, SOMAXCONN) < 0)
+		goto error;
+
+	listener->event = ioevent_read(listener->sock, listener_readable,
+	    listener, 0);
+	listener->retry = ioevent_timer(&tv, listener_retry, listener,
+	    IOEVENT_ONCE);
+	if (listener->event == NULL || listener->retry == NULL)
+		goto error;
+
+	ioendpoint_release((struct ioendpoint *) from);
+
+	return listener;
+
+error:
+	if (listener != NULL) {
+		if (listener->event != NULL)
+			ioevent_free(listener->event);
+		if (listener->retry != NULL)
+			ioevent_free(listener->retry);
+		if (listener->sock >= 0)
+			close(listener->sock);
+	}
+	free(listener);
+	ioendpoint_release((struct ioendpoint *) from);
+
+	return NULL;
+}
+
+void
+iolistener_free(struct iolistener *listener)
+{
+	ioevent_free(listener->event);
+	ioevent_free(listener->retry);
+	close(listener->sock);
+	free(listener);
+}
+
+int
+iolistener_attach(struct iolistener *listener, struct ioloop *loop)
+{
+	/* prevent duplicate attachment */
+	if (listener->loop != NULL) {
+		errno = EBUSY;
+		return -1;
+	}
+
+	if (ioevent_attach(listener->event, loop) < 0)
+		return -1;
+
+	listener->loop = loop;
+
+	return 0;
+}
+
+int
+iolistener_detach(struct iolistener *listener)
+{
+	listener->loop = NULL;
+
+	if (ioevent_attached(listener->retry))
+		return ioevent_detach(listener->retry);
+	return ioevent_detach(listener->event);
+}
+
+static void
+listener_readable(int UNUSED(num), void *arg)
+{
+	struct iolistener	*listener = (struct iolistener *) arg;
+	struct ioqueue		*queue;
+	struct ioendpoint	*from;
+	struct sockaddr_storage	 addr;
+	socklen_t		 addrlen;
+	unsigned int		 n;
+	int			 sock;
+
+	/* take everything that's waiting, within reason, so a wave of
+	 * connections costs one wakeup instead of one each */
+	for (n = 0; n < ACCEPTMAX && listener->loop != NULL; n++) {
+		addrlen = sizeof(addr);
+		sock = accept4(listener->sock, (struct sockaddr *) &addr,
+		    &addrlen, SOCK_CLOEXEC);
+		if (sock < 0) {
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+
+			/* out of descriptors: the connections stay waiting,
+			 * and so would we, so stop listening for a while */
+			if ((errno == EMFILE || errno == ENFILE) &&
+			    ioevent_attach(listener->retry,
+			    listener->loop) == 0)
+				ioevent_detach(listener->event);
+			break;
+		}
+		iosockaddr_trim(&addr, addrlen);
+
+		/* not interned: the connection may well move on to
+		 * another loop */
+		from = ioendpoint_alloc_sockaddr((struct sockaddr *) &addr);
+		if (from == NULL) {
+			close(sock);
+			continue;
+		}
+
+		queue = ioqueue_stream_wrap(sock, from);
+		if (queue == NULL) {
+			ioendpoint_release(from);
+			close(sock);
+			continue;
+		}
+
+		/* the callback may detach the listener, which ends this */
+		listener->cb(queue, from, listener->arg);
+	}
+}
+
+static void
+listener_retry(int UNUSED(num), void *arg)
+{
+	struct iolistener *listener = (struct iolistener *) arg;
+
+	ioevent_attach(listener->event, listener->loop);
+}
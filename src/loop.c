@@ -26,109 +26,118 @@
  *** Timers ****************************************************************
  ***************************************************************************/
 
-static int
-timer_insert(struct ioloop *loop, struct ioevent_timer *evt)
+static void	 timer_update(struct ioloop *, struct ioevent_timer *);
+static void	 hook_queue(struct ioevent_hooks *);
+
+static void
+timer_up(struct ioloop *loop, unsigned int slot)
 {
-	unsigned int base, pos, limit;
+	struct ioevent_timer *evt = loop->timers[slot];
+	unsigned int parent;
 
-	/* find insertion point */
-	base = 0;
-	for (limit = loop->numtimers; limit != 0; limit /= 2) {
-		pos = base + limit / 2;
+	/* move towards the root while we expire before our parent */
+	while (slot > 0) {
+		parent = (slot - 1) / 2;
+		if (!timercmp(&evt->expire, &loop->timers[parent]->expire, <))
+			break;
 
-		/* proceed with right-hand side? */
-		if (timercmp(&evt->remain, &loop->timers[pos]->remain, >)) {
-			base = pos + 1;
-			limit--;
-		}
+		loop->timers[slot] = loop->timers[parent];
+		loop->timers[slot]->slot = slot;
+		slot = parent;
 	}
 
-	/* insert here */
-	memmove(loop->timers + base + 1, loop->timers + base,
-	    (loop->numtimers - base) * sizeof(loop->timers[0]));
-	loop->timers[base] = evt;
-	loop->numtimers++;
-
-	return 0;
+	loop->timers[slot] = evt;
+	evt->slot = slot;
 }
 
-static int
-timer_remove(struct ioloop *loop, struct ioevent_timer *evt)
+static void
+timer_down(struct ioloop *loop, unsigned int slot)
 {
-	unsigned int base, pos, limit;
-
-	/* find insertion point */
-	base = 0;
-	for (limit = loop->numtimers; limit != 0; limit /= 2) {
-		pos = base + limit / 2;
+	struct ioevent_timer *evt = loop->timers[slot];
+	unsigned int child;
+
+	/* move towards the leaves while a child expires before us */
+	while ((child = 2 * slot + 1) < loop->numtimers) {
+		if (child + 1 < loop->numtimers &&
+		    timercmp(&loop->timers[child + 1]->expire,
+		             &loop->timers[child]->expire, <))
+			child++;
+		if (!timercmp(&loop->timers[child]->expire, &evt->expire, <))
+			break;
 
-		/* proceed with right-hand side? */
-		if (timercmp(&evt->remain, &loop->timers[pos]->remain, >)) {
-			base = pos + 1;
-			limit--;
-		}
+		loop->timers[slot] = loop->timers[child];
+		loop->timers[slot]->slot = slot;
+		slot = child;
 	}
 
-	/* we may have found another timer with the same remaining time, so
-	 * we'll need to search linearly for the right one */
-	while (base < loop->numtimers && loop->timers[base] != evt)
-		base++;
+	loop->timers[slot] = evt;
+	evt->slot = slot;
+}
+
+static void
+timer_insert(struct ioloop *loop, struct ioevent_timer *evt)
+{
+	loop->timers[loop->numtimers] = evt;
+	timer_up(loop, loop->numtimers++);
+}
+
+static int
+timer_remove(struct ioloop *loop, struct ioevent_timer *evt)
+{
+	unsigned int slot = evt->slot;
 
-	/* did we run out of timers? */
-	if (base >= loop->numtimers) {
+	/* sanity check */
+	if (slot >= loop->numtimers || loop->timers[slot] != evt) {
 		errno = EINVAL;
 		return -1;
 	}
 
-	assert(loop->timers[base] == evt);
-
-	/* remove the timer */
-	loop->numtimers--;
-	memmove(loop->timers + base, loop->timers + base + 1,
-	    (loop->numtimers - base) * sizeof(loop->timers[0]));
+	/* fill the hole with the last timer and restore the heap */
+	if (slot != --loop->numtimers) {
+		loop->timers[slot] = loop->timers[loop->numtimers];
+		loop->timers[slot]->slot = slot;
+		timer_update(loop, loop->timers[slot]);
+	}
 
 	return 0;
 }
 
-static int
-timer_reset(struct ioevent_timer *evt)
+static void
+timer_update(struct ioloop *loop, struct ioevent_timer *evt)
 {
-	static const struct timeval zero = { 0, 0 };
+	unsigned int slot = evt->slot;
+
+	/* the expiry time changed, so the timer has to move either up or
+	 * down the heap, but never both */
+	if (slot > 0 &&
+	    timercmp(&evt->expire, &loop->timers[(slot - 1) / 2]->expire, <))
+		timer_up(loop, slot);
+	else
+		timer_down(loop, slot);
+}
 
-	if (timer_remove(evt->event.loop, evt) < 0)
-		return -1;
+static void
+timer_reset(struct ioevent_timer *evt)
+{
+	struct ioloop *loop = evt->event.loop;
 
-	timeradd(&evt->remain, &evt->tv, &evt->remain);
-	if (timercmp(&evt->remain, &zero, <) < 0)
-		evt->remain = zero;
+	/* the callback may have re-armed the timer itself */
+	if (timercmp(&evt->expire, &loop->now, >))
+		return;
 
-	if (timer_insert(evt->event.loop, evt) < 0)
-		return -1;
+	/* advance the expiry time by one interval, which keeps periodic
+	 * timers from drifting; if we've fallen behind by more than that,
+	 * expire again as soon as possible */
+	timeradd(&evt->expire, &evt->tv, &evt->expire);
+	if (timercmp(&evt->expire, &loop->now, <))
+		evt->expire = loop->now;
 
-	return 0;
+	timer_update(loop, evt);
 }
 
 static int
 timer_attach(struct ioloop *loop, struct ioevent_timer *evt)
 {
-	unsigned int i;
-
-	/* We're attaching a new timer, which means that the timer
-	 * debt built until now doesn't apply to that timer.
-	 * Therefore, apply the debt to all registered timers (which
-	 * doesn't change their relative ordering), and zero it.
-	 * Note that it is impossible for timers to get a negative
-	 * remaining time: if a timer is expired, then by definition
-	 * the timer debt is set to 0. */
-	if (loop->timerdebt.tv_sec != 0 || loop->timerdebt.tv_usec != 0) {
-		for (i = 0; i < loop->numtimers; i++) {
-			struct ioevent_timer *timer = loop->timers[i];
-			timersub(&timer->remain, &loop->timerdebt, &timer->remain);
-		}
-
-		timerclear(&loop->timerdebt);
-	}
-
 	/* make room for the timer */
 	if (loop->numtimers + 1 > loop->maxtimers) {
 		void		*new;
@@ -138,7 +147,9 @@ timer_attach(struct ioloop *loop, struct ioevent_timer *evt)
 			num = 4;
 		else
 			num = loop->maxtimers * 2;
-		new = realloc(loop->timers, num * sizeof(loop->timers[0]));
+		new = iomem_realloc(loop, loop->timers,
+		    loop->maxtimers * sizeof(loop->timers[0]),
+		    num * sizeof(loop->timers[0]));
 		if (new == NULL)
 			return -1;
 
@@ -146,85 +157,223 @@ timer_attach(struct ioloop *loop, struct ioevent_timer *evt)
 		loop->maxtimers = num;
 	}
 
-	/* initialise the timer */
-	evt->remain = evt->tv;
+	/* initialise the timer, unless it was given an explicit deadline */
+	if (!(evt->event.opt & IOEVENT_DEADLINE)) {
+		gettimeofday(&loop->now, NULL);
+		timeradd(&loop->now, &evt->tv, &evt->expire);
+	}
+	evt->event.opt &= ~IOEVENT_DEADLINE;
+
+	timer_insert(loop, evt);
 
-	return timer_insert(loop, evt);
+	return 0;
 }
 
 static int
 timer_detach(struct ioloop *loop, struct ioevent_timer *evt)
 {
-	if (timer_remove(loop, evt) < 0)
-		return -1;
+	return timer_remove(loop, evt);
+}
+
+static void
+timer_expire(struct ioloop *loop, unsigned int slot)
+{
+	struct ioevent_timer *timer;
+
+	/* queue all expired timers; the heap property guarantees that if a
+	 * timer hasn't expired, none of its children have either */
+	while (slot < loop->numtimers) {
+		timer = loop->timers[slot];
+		if (timercmp(&timer->expire, &loop->now, >))
+			return;
+
+		PROBE2(timer__expire, loop, timer);
+		ioevent_queue((struct ioevent *) timer);
+		timer_expire(loop, 2 * slot + 1);
+		slot = 2 * slot + 2;
+	}
+}
+
+static int
+timeout_attach(struct ioloop *loop, struct ioevent_timeout *evt)
+{
+	struct iotimeout_group *group;
 
-	/* was this the last timer? clear the timer debt */
-	if (loop->numtimers == 0)
-		timerclear(&loop->timerdebt);
+	/* look for the group of timeouts with the same period */
+	LIST_FOREACH(group, &loop->timeouts, groups)
+		if (timercmp(&group->tv, &evt->tv, ==))
+			break;
+
+	/* create one if there's none */
+	if (group == NULL) {
+		group = iomem_zalloc(loop, sizeof(*group));
+		if (group == NULL)
+			return -1;
+
+		group->tv = evt->tv;
+		LIST_INSERT_LAST(&loop->timeouts, group, groups);
+	}
+
+	/* initialise the timeout; it's the most recently active one */
+	gettimeofday(&loop->now, NULL);
+	evt->last = loop->now;
+	evt->group = group;
+
+	LIST_INSERT_LAST(&group->list, evt, list);
 
 	return 0;
 }
 
+static void
+timeout_detach(struct ioloop *loop, struct ioevent_timeout *evt)
+{
+	struct iotimeout_group *group = evt->group;
+
+	LIST_REMOVE(&group->list, evt, list);
+	evt->group = NULL;
+
+	/* was this the last timeout in the group? */
+	if (LIST_EMPTY(&group->list)) {
+		LIST_REMOVE(&loop->timeouts, group, groups);
+		iomem_free(loop, group, sizeof(*group));
+	}
+}
+
+static void
+timeout_expire(struct ioloop *loop)
+{
+	struct iotimeout_group	*group;
+	struct ioevent_timeout	*evt;
+	struct timeval		 expire;
+
+	/* the least recently active timeouts come first; dispatch them and
+	 * start a new period, which makes them the most recent */
+	LIST_FOREACH(group, &loop->timeouts, groups) {
+		while ((evt = LIST_FIRST(&group->list, list)) != NULL) {
+			timeradd(&evt->last, &evt->tv, &expire);
+			if (timercmp(&expire, &loop->now, >))
+				break;
+
+			ioevent_queue((struct ioevent *) evt);
+			evt->last = loop->now;
+
+			LIST_REMOVE_FIRST(&group->list, list);
+			LIST_INSERT_LAST(&group->list, evt, list);
+		}
+	}
+}
+
+static bool
+next_expiry(struct ioloop *loop, struct timeval *tv)
+{
+	struct iotimeout_group	*group;
+	struct ioevent_timeout	*evt;
+	struct timeval		 expire;
+	bool			 found = false;
+
+	/* first timer */
+	if (loop->numtimers != 0) {
+		*tv = loop->timers[0]->expire;
+		found = true;
+	}
+
+	/* first idle timeout of every group */
+	LIST_FOREACH(group, &loop->timeouts, groups) {
+		evt = LIST_FIRST(&group->list, list);
+		timeradd(&evt->last, &evt->tv, &expire);
+		if (!found || timercmp(&expire, tv, <)) {
+			*tv = expire;
+			found = true;
+		}
+	}
+
+	return found;
+}
+
 static int
-once_more_with_timers(struct ioloop *loop, const struct timeval *start,
-                      struct timeval *end)
+once_more_with_timers(struct ioloop *loop, const struct timeval *limit)
 {
-	struct ioevent_timer	*timer = NULL;
-	struct timeval		 tv;
-	unsigned int		 i;
 	struct ioevent_flag	*evf;
+	struct timeval		 tv;
 
-	/* check all flags */
+	/* check all polled flags */
 	LIST_FOREACH(evf, &loop->flags, flags)
 		if (*evf->flag)
 			ioevent_queue((struct ioevent *) evf);
-	if (!LIST_EMPTY(&loop->dispatchq))
+	if (!LIST_EMPTY(&loop->dispatchq) || iohandle_pending(loop))
 		return 0;
 
-	/* calculate the timeout */
-	if (loop->numtimers != 0) {
-		static const struct timeval zero = { 0, 0 };
-
-		timer = loop->timers[0];
-
-		/* take debt into account */
-		timersub(&timer->remain, &loop->timerdebt, &tv);
+	/* calculate the timeout and call the backend; idle events mean we
+	 * can only poll, and we never wait longer than our caller allows */
+	if (!LIST_EMPTY(&loop->idles)) {
+		timerclear(&tv);
 
-		/* call the backend */
-		if (timercmp(&tv, &zero, >=) &&
-		    loop->backend->go(loop, &tv) < 0)
+		if (loop->backend->go(loop, &tv) < 0)
+			return -1;
+	} else if (next_expiry(loop, &tv)) {
+		timersub(&tv, &loop->now, &tv);
+		if (tv.tv_sec < 0)
+			timerclear(&tv);
+		if (limit != NULL && timercmp(limit, &tv, <))
+			tv = *limit;
+
+		if (loop->backend->go(loop, &tv) < 0)
 			return -1;
 	} else {
-		/* call the backend */
-		if (loop->backend->go(loop, NULL) < 0)
+		if (loop->backend->go(loop, limit) < 0)
 			return -1;
 	}
 
-	/* determine how long we waited */
-	gettimeofday(end, NULL);
+	/* determine how long we waited and dispatch expired timers */
+	PROBE1(loop__wakeup, loop);
+	gettimeofday(&loop->now, NULL);
+	timer_expire(loop, 0);
+	timeout_expire(loop);
 
-	/* should we update and dispatch timers? */
-	if (timer == NULL)
-		return 0;
-	timersub(end, start, &tv);
-	timeradd(&loop->timerdebt, &tv, &loop->timerdebt);
-	if (timercmp(&loop->timerdebt, &timer->remain, <))
-		return 0;
+	/* nothing to do? then we're idle */
+	if (LIST_EMPTY(&loop->dispatchq) && !iohandle_pending(loop))
+		hook_queue(&loop->idles);
 
-	/* update all timers */
-	for (i = 0; i < loop->numtimers; i++) {
-		timer = loop->timers[i];
+	return 0;
+}
 
-		/* update remaining time and queue for dispatch if expired */
-		timersub(&timer->remain, &loop->timerdebt, &timer->remain);
-		if (timer->remain.tv_sec < 0 ||
-		    (timer->remain.tv_sec == 0 && timer->remain.tv_usec <= 0))
-			ioevent_queue((struct ioevent *) timer);
-	}
 
-	timerclear(&loop->timerdebt);
+/***************************************************************************
+ *** Flags *****************************************************************
+ ***************************************************************************/
+
+static void
+flag_attach(struct ioloop *loop, struct ioevent_flag *evf)
+{
+	/* polled flags are tested on every iteration of the loop; the
+	 * others only need to be found when the loop is freed */
+	if (ioevent_flag_polled(evf))
+		LIST_INSERT_LAST(&loop->flags, evf, flags);
+	else
+		LIST_INSERT_LAST(&loop->rflags, evf, flags);
+}
+
+static void
+flag_detach(struct ioloop *loop, struct ioevent_flag *evf)
+{
+	if (ioevent_flag_polled(evf))
+		LIST_REMOVE(&loop->flags, evf, flags);
+	else
+		LIST_REMOVE(&loop->rflags, evf, flags);
+}
 
-	return 0;
+
+/***************************************************************************
+ *** Deferred and idle events **********************************************
+ ***************************************************************************/
+
+static void
+hook_queue(struct ioevent_hooks *hooks)
+{
+	struct ioevent_hook *evh;
+
+	LIST_FOREACH(evh, hooks, hooks)
+		ioevent_queue((struct ioevent *) evh);
 }
 
 
@@ -232,9 +381,95 @@ once_more_with_timers(struct ioloop *loop, const struct timeval *start,
  *** Dispatch **************************************************************
  ***************************************************************************/
 
+static void
+batch_append(struct iobatch *batch, struct ioevent *event, int num)
+{
+	struct ioloop		*loop = event->loop;
+	struct ioevent_ready	*ready;
+	unsigned int		 max;
+
+	/* make room; if we can't, just deliver this one by itself */
+	if (batch->num == batch->max) {
+		max = batch->max != 0? batch->max * 2 : 16;
+		if ((ready = realloc(batch->ready, max * sizeof(*ready))) == NULL) {
+			struct ioevent_ready r = { event, num };
+
+			batch->cb(&r, 1, batch->arg);
+			return;
+		}
+
+		batch->ready = ready;
+		batch->max = max;
+	}
+
+	/* the batch is flushed at the end of this pass */
+	if (batch->num == 0) {
+		LIST_INSERT_LAST(&loop->batches, batch, batches);
+		batch->loop = loop;
+	}
+
+	batch->ready[batch->num].event = event;
+	batch->ready[batch->num].num = num;
+	batch->num++;
+}
+
+static void
+batch_flush(struct ioloop *loop)
+{
+	struct ioprofile_clock	 clk;
+	struct iobatch		*batch;
+	unsigned int		 num;
+
+	while (!LIST_EMPTY(&loop->batches)) {
+		batch = LIST_FIRST(&loop->batches, batches);
+		LIST_REMOVE_FIRST(&loop->batches, batches);
+		batch->loop = NULL;
+
+		/* events detached by the callback no longer need to be
+		 * forgotten, so mark the batch empty before calling it */
+		num = batch->num;
+		batch->num = 0;
+		if (num == 0)
+			continue;
+
+		PROBE4(dispatch__entry, loop, batch->cb, 0, num);
+		if (ioprofile_sampled(loop)) {
+			ioprofile_begin(&clk);
+			batch->cb(batch->ready, num, batch->arg);
+			ioprofile_end(loop, &clk, (const void *) batch->cb, 0);
+		} else {
+			batch->cb(batch->ready, num, batch->arg);
+		}
+		PROBE4(dispatch__return, loop, batch->cb, 0, num);
+	}
+}
+
+bool
+iobatch_forget(struct iobatch *batch, struct ioevent *event)
+{
+	unsigned int i;
+
+	/* remove the event from the ready events, if present; an empty
+	 * batch no longer needs flushing */
+	for (i = 0; i < batch->num; i++) {
+		if (batch->ready[i].event == event) {
+			batch->ready[i] = batch->ready[--batch->num];
+			if (batch->num == 0 && batch->loop != NULL) {
+				LIST_REMOVE(&batch->loop->batches, batch,
+				    batches);
+				batch->loop = NULL;
+			}
+			return true;
+		}
+	}
+
+	return false;
+}
+
 static void
 dispatch(struct ioevent *event)
 {
+	struct ioloop *loop = event->loop;
 	enum ioevent_opt opt;
 	int num;
 
@@ -250,6 +485,12 @@ dispatch(struct ioevent *event)
 		break;
 	}
 
+	/* batched events are handed to the batch callback later on */
+	if (event->batch != NULL) {
+		batch_append(event->batch, event, num);
+		return;
+	}
+
 	/* is this a one-shot event? then detach now, so the callback can
 	 * re-attach it if it feels like it */
 	opt = event->opt;
@@ -259,7 +500,7 @@ dispatch(struct ioevent *event)
 
 	/* invoke the callback */
 	if (event != NULL)
-		event->cb(num, event->arg);
+		ioevent_call(loop, event->kind, event->cb, num, event->arg);
 
 	/* did the callback detach us? */
 	if (!ioevent_attached(event))
@@ -274,19 +515,76 @@ dispatch(struct ioevent *event)
 	}
 }
 
-static void
+static unsigned int
 dispatch_queued(struct ioloop *loop)
 {
 	struct ioevent *event;
+	unsigned int n;
 
 	/* dispatch all queued events */
-	while (!LIST_EMPTY(&loop->dispatchq)) {
-		event = LIST_FIRST(&loop->dispatchq, dispatchq);
-		LIST_REMOVE_FIRST(&loop->dispatchq, dispatchq);
-		event->opt &= ~IOEVENT_QUEUED;
-
-		dispatch(event);
+	for (n = 0; ; ) {
+		if (!LIST_EMPTY(&loop->dispatchq)) {
+			event = LIST_FIRST(&loop->dispatchq, dispatchq);
+			LIST_REMOVE_FIRST(&loop->dispatchq, dispatchq);
+			event->opt &= ~IOEVENT_QUEUED;
+
+			dispatch(event);
+			n++;
+		} else if (iohandle_pending(loop)) {
+			n += iohandle_dispatch(loop);
+		} else {
+			break;
+		}
 	}
+
+	/* hand ready events to their batches */
+	batch_flush(loop);
+
+	return n;
+}
+
+static unsigned int
+dispatch_all(struct ioloop *loop)
+{
+	unsigned int n;
+
+	if ((n = dispatch_queued(loop)) == 0)
+		return 0;
+
+	/* give deferred events a chance to act on whatever was done by the
+	 * events we just dispatched */
+	hook_queue(&loop->defers);
+	n += dispatch_queued(loop);
+
+	return n;
+}
+
+
+/***************************************************************************
+ *** Embedding *************************************************************
+ ***************************************************************************/
+
+static int
+embed_update(struct ioloop *loop)
+{
+	struct ioevent_flag	*evf;
+	struct timeval		 tv;
+
+	/* a running loop updates the descriptor when it's done */
+	if (!loop->embedded || loop->running)
+		return 0;
+
+	/* wake up right away if there's work to do */
+	timerclear(&tv);
+	if (!LIST_EMPTY(&loop->dispatchq) || iohandle_pending(loop) ||
+	    !LIST_EMPTY(&loop->idles))
+		return loop->backend->arm(loop, &tv);
+	LIST_FOREACH(evf, &loop->flags, flags)
+		if (*evf->flag)
+			return loop->backend->arm(loop, &tv);
+
+	/* otherwise, when the next timer is due */
+	return loop->backend->arm(loop, next_expiry(loop, &tv)? &tv : NULL);
 }
 
 
@@ -294,10 +592,13 @@ dispatch_queued(struct ioloop *loop)
  *** Public API ************************************************************
  ***************************************************************************/
 
-struct ioloop *
-ioloop_alloc(enum ioevent_kind kinds)
+static struct ioloop *
+loop_alloc(enum ioevent_kind kinds, struct ioarena *arena)
 {
 	static const struct iobackend *backends[] = {
+#ifdef HAVE_EPOLL
+		&iobackend_epoll,
+#endif
 		&iobackend_select
 	};
 	struct ioloop	*loop;
@@ -306,21 +607,28 @@ ioloop_alloc(enum ioevent_kind kinds)
 	/* look for an appropriate backend */
 	for (i = 0; i < nitems(backends); i++) {
 		/* check if it's supported */
-		if (((backends[i]->kinds | IOEVENT_TIMER | IOEVENT_FLAG) & kinds) != kinds)
+		if (((backends[i]->kinds | IOEVENT_GENERIC) & kinds) != kinds)
 			continue;
 
 		/* allocate and initialise the loop */
-		loop = calloc(1, backends[i]->loopsz);
+		if (arena != NULL) {
+			loop = ioarena_get(arena, backends[i]->loopsz);
+			if (loop != NULL)
+				memset(loop, '\0', backends[i]->loopsz);
+		} else {
+			loop = calloc(1, backends[i]->loopsz);
+		}
 		if (loop == NULL)
 			return NULL;
 
 		loop->kinds = kinds;
 		loop->backend = backends[i];
+		loop->arena = arena;
 
 		/* attempt to initialise it */
 		if (loop->backend->init(loop) < 0) {
 			/* maybe the next one works */
-			free(loop);
+			iomem_free(loop, loop, backends[i]->loopsz);
 			continue;
 		}
 
@@ -332,30 +640,82 @@ ioloop_alloc(enum ioevent_kind kinds)
 	return NULL;
 }
 
+struct ioloop *
+ioloop_alloc(enum ioevent_kind kinds)
+{
+	return loop_alloc(kinds, NULL);
+}
+
+struct ioloop *
+ioloop_alloc_node(enum ioevent_kind kinds, int node)
+{
+	struct ioarena	*arena;
+	struct ioloop	*loop;
+
+	/* default to the node we're running on */
+	if (node < 0)
+		node = ioarena_node();
+
+	/* set up the arena, and allocate the loop from it */
+	if ((arena = ioarena_alloc(node)) == NULL)
+		return NULL;
+	if ((loop = loop_alloc(kinds, arena)) == NULL) {
+		ioarena_free(arena);
+		return NULL;
+	}
+
+	return loop;
+}
+
 void
 ioloop_free(struct ioloop *loop)
 {
 	struct ioevent_flag *evf, *next;
 
+	/* don't touch the backend's descriptor while tearing it down */
+	loop->embedded = false;
+
 	/* tear down the backend */
 	loop->backend->done(loop);
 
+	/* release the handle table and profile */
+	iohandle_done(loop);
+	ioprofile_done(loop);
+	iointern_done(loop);
+
 	/* detach all timers */
 	while (loop->numtimers != 0)
 		ioevent_detach((struct ioevent *) loop->timers[loop->numtimers - 1]);
-	free(loop->timers);
+	iomem_free(loop, loop->timers,
+	    loop->maxtimers * sizeof(loop->timers[0]));
+
+	/* detach all idle timeouts */
+	while (!LIST_EMPTY(&loop->timeouts))
+		ioevent_detach((struct ioevent *)
+		    LIST_FIRST(&LIST_FIRST(&loop->timeouts, groups)->list, list));
 
 	/* detach all flags */
 	LIST_FOREACH_SAFE(evf, &loop->flags, flags, next)
 		ioevent_detach((struct ioevent *) evf);
+	LIST_FOREACH_SAFE(evf, &loop->rflags, flags, next)
+		ioevent_detach((struct ioevent *) evf);
 
-	free(loop);
+	/* detach all deferred and idle events */
+	while (!LIST_EMPTY(&loop->defers))
+		ioevent_detach((struct ioevent *) LIST_FIRST(&loop->defers, hooks));
+	while (!LIST_EMPTY(&loop->idles))
+		ioevent_detach((struct ioevent *) LIST_FIRST(&loop->idles, hooks));
+
+	/* the loop itself lives in its arena, if it has one */
+	if (loop->arena != NULL)
+		ioarena_free(loop->arena);
+	else
+		free(loop);
 }
 
 int
 ioloop_once(struct ioloop *loop)
 {
-	struct timeval start, end;
 	int r;
 
 	/* prepare for running */
@@ -364,24 +724,72 @@ ioloop_once(struct ioloop *loop)
 		return -1;
 
 	/* run once */
-	gettimeofday(&start, NULL);
-	r = once_more_with_timers(loop, &start, &end);
+	loop->running = true;
+	gettimeofday(&loop->now, NULL);
+	r = once_more_with_timers(loop, NULL);
 	if (r >= 0)
-		dispatch_queued(loop);
+		dispatch_all(loop);
+	loop->running = false;
 
 	/* clean up after running */
 	if (loop->backend->clean != NULL && 
 	    loop->backend->clean(loop) < 0)
 		return -1;
+	if (embed_update(loop) < 0)
+		return -1;
 
 	return r;
 }
 
+int
+ioloop_step(struct ioloop *loop, const struct timeval *timeout)
+{
+	int r;
+
+	/* prepare for running */
+	if (loop->backend->prep != NULL && 
+	    loop->backend->prep(loop) < 0)
+		return -1;
+
+	/* wait no longer than allowed, then dispatch whatever is ready */
+	loop->running = true;
+	gettimeofday(&loop->now, NULL);
+	r = once_more_with_timers(loop, timeout);
+	if (r >= 0)
+		r = dispatch_all(loop);
+	loop->running = false;
+
+	/* clean up after running */
+	if (loop->backend->clean != NULL && 
+	    loop->backend->clean(loop) < 0)
+		return -1;
+	if (embed_update(loop) < 0)
+		return -1;
+
+	return r;
+}
+
+int
+ioloop_fd(struct ioloop *loop)
+{
+	/* sanity check */
+	if (loop->backend->fd == NULL) {
+		errno = ENOTSUP;
+		return -1;
+	}
+
+	/* from now on, keep the descriptor's readiness up to date */
+	loop->embedded = true;
+	if (embed_update(loop) < 0)
+		return -1;
+
+	return loop->backend->fd(loop);
+}
+
 int
 ioloop_run(struct ioloop *loop)
 {
-	struct timeval tv[2];
-	int i, r;
+	int r;
 
 	loop->broken = false;
 
@@ -390,26 +798,28 @@ ioloop_run(struct ioloop *loop)
 	    loop->backend->prep(loop) < 0)
 		return -1;
 
-	i = 0;
-	gettimeofday(tv + i, NULL);
+	gettimeofday(&loop->now, NULL);
 
 	/* run until we're done */
+	r = 0;
+	loop->running = true;
 	while (loop->num > 0 && !loop->broken) {
 		/* wait for events */
-		r = once_more_with_timers(loop, tv + i, tv + (!i));
+		r = once_more_with_timers(loop, NULL);
 		if (r < 0)
 			break;
 
 		/* dispatch events */
-		dispatch_queued(loop);
-
-		i = !i;
+		dispatch_all(loop);
 	}
+	loop->running = false;
 
 	/* clean up after running */
 	if (loop->backend->clean != NULL && 
 	    loop->backend->clean(loop) < 0)
 		return -1;
+	if (embed_update(loop) < 0)
+		return -1;
 
 	return r;
 }
@@ -444,8 +854,21 @@ ioevent_attach(struct ioevent *event, struct ioloop *loop)
 			return -1;
 		break;
 
+	case IOEVENT_TIMEOUT:
+		if (timeout_attach(loop, (struct ioevent_timeout *) event) < 0)
+			return -1;
+		break;
+
 	case IOEVENT_FLAG:
-		LIST_INSERT_LAST(&loop->flags, (struct ioevent_flag *) event, flags);
+		flag_attach(loop, (struct ioevent_flag *) event);
+		break;
+
+	case IOEVENT_DEFER:
+		LIST_INSERT_LAST(&loop->defers, (struct ioevent_hook *) event, hooks);
+		break;
+
+	case IOEVENT_IDLE:
+		LIST_INSERT_LAST(&loop->idles, (struct ioevent_hook *) event, hooks);
 		break;
 
 	default:
@@ -457,6 +880,19 @@ ioevent_attach(struct ioevent *event, struct ioloop *loop)
 	event->loop = loop;
 	loop->num++;
 
+	/* an owned flag may have been set before the event was attached, in
+	 * which case it missed being raised */
+	if (event->kind == IOEVENT_FLAG) {
+		struct ioevent_flag *evf = (struct ioevent_flag *) event;
+
+		if (evf->owner != NULL && *evf->flag)
+			ioevent_queue(event);
+	}
+
+	/* a new deadline may be the earliest one */
+	if (event->kind & (IOEVENT_TIMER | IOEVENT_TIMEOUT | IOEVENT_IDLE))
+		embed_update(loop);
+
 	return 0;
 }
 
@@ -476,8 +912,20 @@ ioevent_detach(struct ioevent *event)
 			return -1;
 		break;
 
+	case IOEVENT_TIMEOUT:
+		timeout_detach(event->loop, (struct ioevent_timeout *) event);
+		break;
+
 	case IOEVENT_FLAG:
-		LIST_REMOVE(&event->loop->flags, (struct ioevent_flag *) event, flags);
+		flag_detach(event->loop, (struct ioevent_flag *) event);
+		break;
+
+	case IOEVENT_DEFER:
+		LIST_REMOVE(&event->loop->defers, (struct ioevent_hook *) event, hooks);
+		break;
+
+	case IOEVENT_IDLE:
+		LIST_REMOVE(&event->loop->idles, (struct ioevent_hook *) event, hooks);
 		break;
 
 	default:
@@ -487,10 +935,9 @@ ioevent_detach(struct ioevent *event)
 	}
 
 	/* remove from the dispatch queue if queued */
-	if (event->opt & IOEVENT_QUEUED) {
-		LIST_REMOVE(&event->loop->dispatchq, event, dispatchq);
-		event->opt &= ~IOEVENT_QUEUED;
-	}
+	ioevent_dequeue(event);
+	if (event->batch != NULL)
+		iobatch_forget(event->batch, event);
 
 	event->loop->num--;
 	event->loop = NULL;
@@ -502,13 +949,128 @@ ioevent_detach(struct ioevent *event)
 	return 0;
 }
 
+int
+ioevent_timer_set(struct ioevent *event, const struct timeval *tv)
+{
+	struct ioevent_timer *evt = (struct ioevent_timer *) event;
+
+	/* sanity check */
+	if (event->kind != IOEVENT_TIMER) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	evt->tv = *tv;
+	event->opt &= ~IOEVENT_DEADLINE;
+
+	/* re-arm in place if attached */
+	if (ioevent_attached(event)) {
+		gettimeofday(&event->loop->now, NULL);
+		timeradd(&event->loop->now, tv, &evt->expire);
+		timer_update(event->loop, evt);
+		ioevent_dequeue(event);
+		embed_update(event->loop);
+	}
+
+	return 0;
+}
+
+int
+ioevent_timer_at(struct ioevent *event, const struct timeval *when)
+{
+	struct ioevent_timer *evt = (struct ioevent_timer *) event;
+
+	/* sanity check */
+	if (event->kind != IOEVENT_TIMER) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	evt->expire = *when;
+
+	/* re-arm in place if attached, otherwise remember the deadline for
+	 * when we do get attached */
+	if (ioevent_attached(event)) {
+		timer_update(event->loop, evt);
+		if (timercmp(when, &event->loop->now, >))
+			ioevent_dequeue(event);
+		embed_update(event->loop);
+	} else {
+		event->opt |= IOEVENT_DEADLINE;
+	}
+
+	return 0;
+}
+
+int
+ioevent_flag_raise(struct ioevent *event)
+{
+	/* sanity check */
+	if (event->kind != IOEVENT_FLAG || !ioevent_attached(event)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	ioevent_queue(event);
+
+	return 0;
+}
+
+int
+ioevent_timeout_touch(struct ioevent *event)
+{
+	struct ioevent_timeout *evt;
+
+	/* sanity check */
+	if (event->kind != IOEVENT_TIMEOUT || !ioevent_attached(event)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	evt = (struct ioevent_timeout *) event;
+	evt->last = event->loop->now;
+
+	/* keep the group ordered by activity */
+	if (LIST_NEXT(evt, list) != NULL) {
+		LIST_REMOVE(&evt->group->list, evt, list);
+		LIST_INSERT_LAST(&evt->group->list, evt, list);
+	}
+
+	return 0;
+}
+
 void
 ioevent_queue(struct ioevent *event)
 {
-	/* sanity check: event already queued? */
-	if (event->opt & IOEVENT_QUEUED)
+	/* events belonging to handles are queued in their table */
+	if (event->opt & IOEVENT_HANDLE) {
+		iohandle_queue(event->loop, event);
+	} else {
+		/* sanity check: event already queued? */
+		if (event->opt & IOEVENT_QUEUED)
+			return;
+
+		LIST_INSERT_LAST(&event->loop->dispatchq, event, dispatchq);
+		event->opt |= IOEVENT_QUEUED;
+	}
+
+	/* whoever polls an embedded loop needs to know about this */
+	embed_update(event->loop);
+}
+
+void
+ioevent_dequeue(struct ioevent *event)
+{
+	/* events belonging to handles are queued in their table */
+	if (event->opt & IOEVENT_HANDLE) {
+		iohandle_dequeue(event->loop, event);
+		return;
+	}
+
+	/* sanity check: event not queued? */
+	if (!(event->opt & IOEVENT_QUEUED))
 		return;
 
-	LIST_INSERT_LAST(&event->loop->dispatchq, event, dispatchq);
-	event->opt |= IOEVENT_QUEUED;
+	LIST_REMOVE(&event->loop->dispatchq, event, dispatchq);
+	event->opt &= ~IOEVENT_QUEUED;
 }
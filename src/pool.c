@@ -0,0 +1,221 @@
+/*
+ * Copyright (c) 2011, Wouter Coene <wouter@irdc.nl>
+ * 
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#include <io/pool.h>
+#include "private.h"
+
+#include <stdlib.h>
+
+/*
+ * Slabs hold a buffer's bookkeeping followed by its data area, which
+ * consists of the headroom, the contents and the tailroom.
+ */
+struct iopool_slab {
+	struct iopbuf		 buf;		/* buffer, as handed out */
+	struct iopool_slab	*next;		/* next free slab */
+};
+
+struct iopool {
+	struct ioloop		*loop;		/* loop to take memory from */
+	size_t			 size,		/* size of the contents */
+				 headroom,	/* room in front of them */
+				 tailroom;	/* room behind them */
+	struct iopool_slab	*free;		/* slabs not in use */
+	unsigned int		 used;		/* slabs in use */
+	bool			 dead;		/* freed while slabs in use */
+};
+
+static size_t	 slab_size(const struct iopool *);
+static unsigned char
+		*slab_data(const struct iopbuf *);
+static void	 pool_done(struct iopool *);
+
+static size_t
+slab_size(const struct iopool *pool)
+{
+	return sizeof(struct iopool_slab) + pool->headroom + pool->size +
+	    pool->tailroom;
+}
+
+static unsigned char *
+slab_data(const struct iopbuf *buf)
+{
+	return (unsigned char *) ((const struct iopool_slab *) buf + 1);
+}
+
+struct iopool *
+iopool_alloc(struct ioloop *loop, size_t size, size_t headroom,
+             size_t tailroom)
+{
+	struct iopool *pool;
+
+	pool = iomem_zalloc(loop, sizeof(*pool));
+	if (pool == NULL)
+		return NULL;
+
+	pool->loop = loop;
+	pool->size = size;
+	pool->headroom = headroom;
+	pool->tailroom = tailroom;
+
+	return pool;
+}
+
+void
+iopool_free(struct iopool *pool)
+{
+	if (pool == NULL)
+		return;
+
+	/* buffers still in use take the pool down with them */
+	pool->dead = true;
+	if (pool->used == 0)
+		pool_done(pool);
+}
+
+static void
+pool_done(struct iopool *pool)
+{
+	struct iopool_slab *slab;
+
+	while ((slab = pool->free) != NULL) {
+		pool->free = slab->next;
+		iomem_free(pool->loop, slab, slab_size(pool));
+	}
+
+	iomem_free(pool->loop, pool, sizeof(*pool));
+}
+
+struct iopbuf *
+iopbuf_alloc(struct iopool *pool)
+{
+	struct iopool_slab *slab;
+
+	/* reuse a slab if there is one, or make a new one */
+	if ((slab = pool->free) != NULL)
+		pool->free = slab->next;
+	else if ((slab = iomem_alloc(pool->loop, slab_size(pool))) == NULL)
+		return NULL;
+
+	pool->used++;
+
+	slab->buf.pool = pool;
+	slab->buf.refs = 1;
+	slab->buf.base = slab_data(&slab->buf) + pool->headroom;
+	slab->buf.len = pool->size;
+
+	return &slab->buf;
+}
+
+struct iopbuf *
+iopbuf_retain(struct iopbuf *buf)
+{
+	if (buf != NULL)
+		buf->refs++;
+
+	return buf;
+}
+
+void
+iopbuf_release(struct iopbuf *buf)
+{
+	struct iopool_slab *slab = (struct iopool_slab *) buf;
+	struct iopool *pool;
+
+	if (buf == NULL || --buf->refs > 0)
+		return;
+
+	/* back into the pool */
+	pool = buf->pool;
+	slab->next = pool->free;
+	pool->free = slab;
+
+	if (--pool->used == 0 && pool->dead)
+		pool_done(pool);
+}
+
+size_t
+iopbuf_headroom(const struct iopbuf *buf)
+{
+	return (size_t) ((unsigned char *) buf->base - slab_data(buf));
+}
+
+size_t
+iopbuf_tailroom(const struct iopbuf *buf)
+{
+	const struct iopool *pool = buf->pool;
+
+	return pool->headroom + pool->size + pool->tailroom -
+	    iopbuf_headroom(buf) - buf->len;
+}
+
+void *
+iopbuf_push(struct iopbuf *buf, size_t len)
+{
+	if (len > iopbuf_headroom(buf)) {
+		errno = ENOBUFS;
+		return NULL;
+	}
+
+	buf->base = (unsigned char *) buf->base - len;
+	buf->len += len;
+
+	return buf->base;
+}
+
+void *
+iopbuf_pull(struct iopbuf *buf, size_t len)
+{
+	if (len > buf->len) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	buf->base = (unsigned char *) buf->base + len;
+	buf->len -= len;
+
+	return buf->base;
+}
+
+void *
+iopbuf_put(struct iopbuf *buf, size_t len)
+{
+	void *p;
+
+	if (len > iopbuf_tailroom(buf)) {
+		errno = ENOBUFS;
+		return NULL;
+	}
+
+	p = (unsigned char *) buf->base + buf->len;
+	buf->len += len;
+
+	return p;
+}
+
+int
+iopbuf_trim(struct iopbuf *buf, size_t len)
+{
+	if (len > buf->len) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	buf->len -= len;
+
+	return 0;
+}
@@ -20,12 +20,15 @@
 #include <io/defs.h>
 #include <io/loop.h>
 #include <io/event.h>
+#include <io/queue.h>
 #include "list.h"
+#include "probes.h"
 
 #include <assert.h>
 #include <errno.h>
 #include <stdint.h>
 #include <sys/time.h>
+#include <time.h>
 
 #define nitems(arr)	(sizeof(arr) / sizeof((arr)[0]))
 
@@ -41,13 +44,33 @@
 # define UNUSED(x)	unused_ ## x
 #endif
 
+#ifdef __GNUC__
+# define atomic_inc(p)	__atomic_add_fetch((p), 1, __ATOMIC_RELAXED)
+# define atomic_dec(p)	__atomic_sub_fetch((p), 1, __ATOMIC_ACQ_REL)
+#else
+# error "atomic operations are not available with this compiler"
+#endif
+
+/*
+ * Kinds of events handled by the I/O loop itself, whatever the backend
+ */
+#define IOEVENT_GENERIC	(IOEVENT_TIMER | IOEVENT_FLAG | IOEVENT_TIMEOUT | \
+			 IOEVENT_DEFER | IOEVENT_IDLE)
+
 /*
  * Internal-use event options
  */
 enum {
+	IOEVENT_HANDLE		= 0x20,		/* event belongs to a handle */
+	IOEVENT_DEADLINE	= 0x40,		/* timer has an explicit deadline */
 	IOEVENT_QUEUED		= 0x80		/* event is queued for dispatch */
 };
 
+/*
+ * List of deferred or idle events
+ */
+LIST_HEAD(ioevent_hooks, ioevent_hook);
+
 /*
  * I/O loop structure
  */
@@ -55,13 +78,24 @@ struct ioloop {
 	const struct iobackend	*backend;	/* backend to use */
 	enum ioevent_kind	 kinds;		/* supported events kinds */
 	unsigned int		 num;		/* number of events registered */
-	struct ioevent_timer	**timers;	/* sorted array of timers */
+	struct ioevent_timer	**timers;	/* heap of timers */
 	unsigned int		 numtimers,	/* number of timer events */
 				 maxtimers;	/* max. number of timer events */
-	struct timeval		 timerdebt;	/* time to be sub'd from timers */
-	LIST_HEAD(, ioevent_flag) flags;	/* list of flag events */
+	struct timeval		 now;		/* time of the last wakeup */
+	LIST_HEAD(, iotimeout_group) timeouts;	/* idle timeouts by duration */
+	LIST_HEAD(, ioevent_flag) flags;	/* list of polled flag events */
+	LIST_HEAD(, ioevent_flag) rflags;	/* list of raised flag events */
+	struct ioevent_hooks	 defers,	/* list of deferred events */
+				 idles;		/* list of idle events */
 	LIST_HEAD(, ioevent)	 dispatchq;	/* dispatch queue */
-	bool			 broken;	/* ioloop_break() called */
+	LIST_HEAD(, iobatch)	 batches;	/* batches with ready events */
+	struct iohandles	*handles;	/* handle table, if any */
+	struct ioprofile	*profile;	/* callback profile, if any */
+	struct ioarena		*arena;		/* memory arena, if any */
+	struct iointern		*intern;	/* endpoint table, if any */
+	bool			 broken,	/* ioloop_break() called */
+				 running,	/* inside ioloop_step() et al. */
+				 embedded;	/* ioloop_fd() called */
 };
 
 /*
@@ -73,6 +107,7 @@ struct ioevent {
 	ioevent_cb_t		*cb;		/* callback function */
 	void			*arg;		/* callback argument */
 	struct ioloop		*loop;		/* loop we're attached to */
+	struct iobatch		*batch;		/* batch we're bound to */
 	LIST_ENTRY(, ioevent)	 dispatchq;	/* dispatch queue entry */
 };
 
@@ -83,8 +118,26 @@ struct ioevent_fd {
 
 struct ioevent_timer {
 	struct ioevent		 event;
-	struct timeval		 tv,
-				 remain;
+	struct timeval		 tv,		/* interval */
+				 expire;	/* absolute expiry time */
+	unsigned int		 slot;		/* index into the timer heap */
+};
+
+struct ioevent_timeout {
+	struct ioevent		 event;
+	struct timeval		 tv,		/* period of inactivity */
+				 last;		/* time of last activity */
+	struct iotimeout_group	*group;		/* group we're part of */
+	LIST_ENTRY(, ioevent_timeout) list;
+};
+
+/*
+ * Idle timeouts sharing the same period, ordered by last activity
+ */
+struct iotimeout_group {
+	struct timeval		 tv;		/* period of inactivity */
+	LIST_HEAD(, ioevent_timeout) list;	/* timeouts in the group */
+	LIST_ENTRY(, iotimeout_group) groups;
 };
 
 struct ioevent_signal {
@@ -97,10 +150,38 @@ struct ioevent_child {
 	pid_t			 child;
 };
 
+/*
+ * List of flag events which are raised together
+ */
+LIST_HEAD(ioflag_list, ioevent_flag);
+
 struct ioevent_flag {
 	struct ioevent		 event;
-	bool			*flag;
+	bool			*flag;		/* flag to test, if any */
+	struct ioflag_list	*owner;		/* list we're part of, if any */
 	LIST_ENTRY(, ioevent_flag) flags;
+	LIST_ENTRY(, ioevent_flag) owned;
+};
+
+static inline bool
+ioevent_flag_polled(struct ioevent_flag *evf)
+{
+	return evf->flag != NULL && evf->owner == NULL;
+}
+
+struct ioevent_hook {
+	struct ioevent		 event;
+	LIST_ENTRY(, ioevent_hook) hooks;
+};
+
+struct iobatch {
+	ioevent_batch_cb_t	*cb;		/* callback function */
+	void			*arg;		/* callback argument */
+	struct ioevent_ready	*ready;		/* events ready this pass */
+	unsigned int		 num,		/* number of ready events */
+				 max;		/* room for ready events */
+	struct ioloop		*loop;		/* loop to flush us, if any */
+	LIST_ENTRY(, iobatch)	 batches;	/* list of batches to flush */
 };
 
 static inline bool
@@ -111,7 +192,158 @@ ioevent_attached(struct ioevent *event)
 
 void	 ioevent_init(struct ioevent *event, enum ioevent_kind kind,
 	              ioevent_cb_t *cb, void *arg, enum ioevent_opt opt);
+struct ioevent *
+	 ioevent_flag_owned(struct ioflag_list *owner, bool *flag,
+	                    ioevent_cb_t *cb, void *arg, enum ioevent_opt opt);
+void	 ioflag_list_raise(struct ioflag_list *list);
+void	 ioflag_list_orphan(struct ioflag_list *list);
 void	 ioevent_queue(struct ioevent *event);
+void	 ioevent_dequeue(struct ioevent *event);
+bool	 iobatch_forget(struct iobatch *batch, struct ioevent *event);
+
+/*
+ * Total length of a batch of datagrams
+ */
+static inline size_t
+iomsg_len(const struct iomsg *msgs, ssize_t nmsgs)
+{
+	size_t len = 0;
+	ssize_t i;
+
+	for (i = 0; i < nmsgs; i++)
+		len += msgs[i].len;
+
+	return len;
+}
+
+/*
+ * Memory arenas. Loops allocated for a particular NUMA node take their
+ * memory from an arena bound to that node, which is carved out of
+ * hugepages where possible. Freeing requires the size of the allocation.
+ * The iomem functions use the loop's arena if it has one, or malloc
+ * otherwise.
+ */
+int	 ioarena_node(void);
+struct ioarena *
+	 ioarena_alloc(int node);
+void	 ioarena_free(struct ioarena *arena);
+void	*ioarena_get(struct ioarena *arena, size_t size);
+void	 ioarena_put(struct ioarena *arena, void *ptr, size_t size);
+
+void	*iomem_alloc(struct ioloop *loop, size_t size);
+void	*iomem_zalloc(struct ioloop *loop, size_t size);
+void	*iomem_realloc(struct ioloop *loop, void *ptr, size_t oldsz,
+	               size_t newsz);
+void	 iomem_free(struct ioloop *loop, void *ptr, size_t size);
+
+/*
+ * Callback profiling. Dispatches are sampled at random intervals averaging
+ * the sampling rate, and the time spent in sampled callbacks is attributed
+ * to the callback function and event kind.
+ */
+struct ioprofile_entry {
+	const void		*fn;		/* callback function */
+	enum ioevent_kind	 kind;		/* kind of event, 0 for batches */
+	uint64_t		 samples,	/* number of sampled calls */
+				 wall,		/* wall-clock time, in ns */
+				 cpu,		/* thread CPU time, in ns */
+				 maxwall;	/* longest call, in ns */
+};
+
+struct ioprofile {
+	unsigned int		 rate,		/* average sampling interval */
+				 countdown;	/* dispatches until next sample */
+	uint32_t		 seed;		/* for randomising the interval */
+	struct ioprofile_entry	*entries;	/* hash table of entries */
+	unsigned int		 num,		/* number of entries in use */
+				 max;		/* size of the hash table */
+};
+
+struct ioprofile_clock {
+	struct timespec		 wall,		/* when the call started */
+				 cpu;
+};
+
+void	 ioprofile_begin(struct ioprofile_clock *clk);
+void	 ioprofile_end(struct ioloop *loop, const struct ioprofile_clock *clk,
+	               const void *fn, enum ioevent_kind kind);
+void	 ioprofile_done(struct ioloop *loop);
+
+static inline bool
+ioprofile_sampled(struct ioloop *loop)
+{
+	return loop->profile != NULL && --loop->profile->countdown == 0;
+}
+
+static inline void
+ioevent_call(struct ioloop *loop, enum ioevent_kind kind, ioevent_cb_t *cb,
+             int num, void *arg)
+{
+	struct ioprofile_clock clk;
+
+	PROBE4(dispatch__entry, loop, cb, kind, num);
+	if (ioprofile_sampled(loop)) {
+		ioprofile_begin(&clk);
+		cb(num, arg);
+		ioprofile_end(loop, &clk, (const void *) cb, kind);
+	} else {
+		cb(num, arg);
+	}
+	PROBE4(dispatch__return, loop, cb, kind, num);
+}
+
+/*
+ * Event handle tables. A handle holds a generation number and an index
+ * into a structure of arrays, which keeps the fields needed for dispatch
+ * packed together. The backend still sees ordinary events, which are kept
+ * in chunks that never move.
+ */
+#define IOHANDLE_INDEX_BITS	20		/* bits of index in handle */
+#define IOHANDLE_CHUNK		256		/* number of events per chunk */
+
+struct iohandle_event {
+	struct ioevent_fd	 event;
+	uint32_t		 index;		/* index into handle table */
+};
+
+struct iohandles {
+	uint16_t		*kind;		/* kind of event, 0 if free */
+	uint8_t			*opt;		/* event options */
+	int			*fd;		/* file descriptor */
+	ioevent_cb_t		**cb;		/* callback function */
+	void			**arg;		/* callback argument */
+	uint64_t		*queued;	/* bitmap of queued events */
+	unsigned int		 npending,	/* number of queued events */
+				 lo,		/* first word with queued events */
+				 hi;		/* last word with queued events */
+
+	uint16_t		*gen;		/* generation numbers */
+	uint32_t		*free;		/* stack of free indices */
+	struct iohandle_event	**chunks;	/* events seen by the backend */
+	unsigned int		 num,		/* number of indices handed out */
+				 max,		/* number of indices allocated */
+				 nfree;		/* number of free indices */
+};
+
+void		 iohandle_queue(struct ioloop *loop, struct ioevent *event);
+void		 iohandle_dequeue(struct ioloop *loop, struct ioevent *event);
+unsigned int	 iohandle_dispatch(struct ioloop *loop);
+void		 iohandle_done(struct ioloop *loop);
+
+static inline bool
+iohandle_pending(struct ioloop *loop)
+{
+	return loop->handles != NULL && loop->handles->npending != 0;
+}
+
+/*
+ * Endpoint interning, which the socket code does on behalf of a loop. The
+ * table of canonical endpoints is freed with the loop; the endpoints
+ * themselves live on.
+ */
+struct iointern;
+
+void		 iointern_done(struct ioloop *loop);
 
 /*
  * I/O loop backends
@@ -128,9 +360,18 @@ struct iobackend {
 	int			(*prep)(struct ioloop *);
 	int			(*go)(struct ioloop *, const struct timeval *);
 	int			(*clean)(struct ioloop *);
+
+	/* for embedding: return a pollable descriptor, and make it readable
+	 * at an absolute time (NULL for never, zero for right away) */
+	int			(*fd)(struct ioloop *);
+	int			(*arm)(struct ioloop *, const struct timeval *);
 };
 
-const struct iobackend
+extern const struct iobackend
 iobackend_select;
+#ifdef HAVE_EPOLL
+extern const struct iobackend
+iobackend_epoll;
+#endif
 
 #endif /* PRIVATE_H */
@@ -29,6 +29,45 @@ struct ioendpoint_socket {
 	struct ioendpoint	 endpoint;
 	struct sockaddr_storage	 addr;
 	socklen_t		 addrlen;
+	uint32_t		 hash;		/* hash of addr, if interned */
+	struct iointern		*intern;	/* table we're in, if any */
 };
 
+uint32_t iosockaddr_hash(const struct sockaddr_storage *addr);
+size_t	 iosockaddr_format(const struct sockaddr_storage *addr, char *buf,
+	                   size_t len);
+int	 iosockaddr_compare(const struct sockaddr_storage *a,
+	                    const struct sockaddr_storage *b);
+
+/*
+ * Make a received address fit for hashing and comparing: only the first
+ * addrlen bytes were filled in, but AF_UNIX paths are looked at in full.
+ */
+void	 iosockaddr_trim(struct sockaddr_storage *addr, socklen_t addrlen);
+
+/*
+ * Stream queue around a connected socket. Takes over the socket and the
+ * reference to the peer endpoint on success.
+ */
+struct ioqueue *
+	 ioqueue_stream_wrap(int sock, struct ioendpoint *peer);
+
+/*
+ * Compact endpoints fill in a socket address on request. Returns -1 if
+ * the endpoint isn't a compact one.
+ */
+int	 ioendpoint_inet_sockaddr(struct ioendpoint *endp,
+	                          struct sockaddr_storage *addr,
+	                          socklen_t *addrlen);
+
+/*
+ * Endpoint interning. The canonical endpoint for an address is looked up
+ * or created with iointern_get(), which returns a new reference. Tables
+ * don't hold references themselves: endpoints leave when they're freed.
+ */
+struct ioendpoint_socket *
+	 iointern_get(struct ioloop *loop, const struct sockaddr_storage *addr,
+	              socklen_t addrlen);
+void	 iointern_remove(struct ioendpoint_socket *endp);
+
 #endif /* PRIVATE_SOCKET_H */
@@ -0,0 +1,64 @@
+/*
+ * Copyright (c) 2011, Wouter Coene <wouter@irdc.nl>
+ * 
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef PROBES_H
+#define PROBES_H
+
+/*
+ * Static tracepoints, for use with SystemTap, perf or bpftrace. These are
+ * only compiled in if <sys/sdt.h> is available, and cost no more than a
+ * nop each when nobody is tracing. Define IO_PROBES to insist on having
+ * them, or IO_NO_PROBES to leave them out altogether.
+ *
+ * Provider "libio", with probes:
+ *  - loop__wakeup(loop): backend returned from waiting for events
+ *  - dispatch__entry(loop, cb, kind, num): about to invoke a callback;
+ *    for a batch, kind is 0 and num the number of ready events
+ *  - dispatch__return(loop, cb, kind, num): callback returned
+ *  - timer__expire(loop, event): timer expired and was queued
+ *  - queue__send(queue, result, errno): datagram sent, or not
+ *  - queue__recv(queue, result, errno): datagram received, or not
+ *  - queue__sendm(queue, result, errno): batch of datagrams sent
+ *  - queue__recvm(queue, result, errno): batch of datagrams received
+ *  - queue__send_zc(queue, result, errno): datagram sent without copying
+ *
+ * The queue probes only fire for queues that do the actual I/O, so that
+ * rate-limiting and monitoring queues layered on top don't count every
+ * datagram more than once.
+ */
+#if defined(IO_PROBES)
+# include <sys/sdt.h>
+# define IO_HAVE_PROBES
+#elif !defined(IO_NO_PROBES) && defined(__has_include)
+# if __has_include(<sys/sdt.h>)
+#  include <sys/sdt.h>
+#  define IO_HAVE_PROBES
+# endif
+#endif
+
+#ifdef IO_HAVE_PROBES
+# define PROBE1(name, a)		DTRACE_PROBE1(libio, name, a)
+# define PROBE2(name, a, b)		DTRACE_PROBE2(libio, name, a, b)
+# define PROBE3(name, a, b, c)		DTRACE_PROBE3(libio, name, a, b, c)
+# define PROBE4(name, a, b, c, d)	DTRACE_PROBE4(libio, name, a, b, c, d)
+#else
+# define PROBE1(name, a)		do { } while (0)
+# define PROBE2(name, a, b)		do { } while (0)
+# define PROBE3(name, a, b, c)		do { } while (0)
+# define PROBE4(name, a, b, c, d)	do { } while (0)
+#endif
+
+#endif /* PROBES_H */
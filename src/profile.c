@@ -0,0 +1,256 @@
+/*
+ * Copyright (c) 2011, Wouter Coene <wouter@irdc.nl>
+ * 
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* for dladdr() */
+#define _GNU_SOURCE
+
+#include <io/loop.h>
+#include "private.h"
+
+#include <dlfcn.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char *
+kind_name(enum ioevent_kind kind)
+{
+	/* batches may mix kinds */
+	if (kind == 0)
+		return "batch";
+
+	switch (kind) {
+	case IOEVENT_READ:	return "read";
+	case IOEVENT_WRITE:	return "write";
+	case IOEVENT_TIMER:	return "timer";
+	case IOEVENT_SIGNAL:	return "signal";
+	case IOEVENT_CHILD:	return "child";
+	case IOEVENT_FLAG:	return "flag";
+	case IOEVENT_TIMEOUT:	return "timeout";
+	case IOEVENT_DEFER:	return "defer";
+	case IOEVENT_IDLE:	return "idle";
+	default:		return "?";
+	}
+}
+
+static unsigned int
+next_interval(struct ioprofile *p)
+{
+	/* xorshift; the interval is uniformly distributed around the rate,
+	 * so callbacks dispatched in a fixed rotation are still sampled
+	 * fairly */
+	p->seed ^= p->seed << 13;
+	p->seed ^= p->seed >> 17;
+	p->seed ^= p->seed << 5;
+
+	return 1 + p->seed % (2 * p->rate - 1);
+}
+
+static uint64_t
+elapsed(const struct timespec *from, const struct timespec *to)
+{
+	return (uint64_t) (to->tv_sec - from->tv_sec) * 1000000000 +
+	    to->tv_nsec - from->tv_nsec;
+}
+
+static unsigned int
+hash(const void *fn, enum ioevent_kind kind)
+{
+	uint64_t h = (uintptr_t) fn ^ kind;
+
+	h *= UINT64_C(0x9e3779b97f4a7c15);
+
+	return h >> 32;
+}
+
+static struct ioprofile_entry *
+lookup(struct ioprofile *p, const void *fn, enum ioevent_kind kind)
+{
+	struct ioprofile_entry *e;
+	unsigned int i;
+
+	/* linear probing; the table is never more than half full */
+	for (i = hash(fn, kind) & (p->max - 1); ; i = (i + 1) & (p->max - 1)) {
+		e = &p->entries[i];
+		if (e->fn == NULL || (e->fn == fn && e->kind == kind))
+			return e;
+	}
+}
+
+static int
+grow(struct ioprofile *p)
+{
+	struct ioprofile_entry	*old = p->entries, *e;
+	unsigned int		 oldmax = p->max, i;
+
+	/* allocate a table twice the size */
+	p->max = oldmax != 0? oldmax * 2 : 64;
+	if ((p->entries = calloc(p->max, sizeof(*p->entries))) == NULL) {
+		p->entries = old;
+		p->max = oldmax;
+		return -1;
+	}
+
+	/* and rehash */
+	for (i = 0; i < oldmax; i++) {
+		if (old[i].fn == NULL)
+			continue;
+
+		e = lookup(p, old[i].fn, old[i].kind);
+		*e = old[i];
+	}
+	free(old);
+
+	return 0;
+}
+
+void
+ioprofile_begin(struct ioprofile_clock *clk)
+{
+	clock_gettime(CLOCK_MONOTONIC, &clk->wall);
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &clk->cpu);
+}
+
+void
+ioprofile_end(struct ioloop *loop, const struct ioprofile_clock *clk,
+              const void *fn, enum ioevent_kind kind)
+{
+	struct ioprofile	*p = loop->profile;
+	struct ioprofile_entry	*e;
+	struct timespec		 wall, cpu;
+	uint64_t		 t;
+
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu);
+	clock_gettime(CLOCK_MONOTONIC, &wall);
+
+	/* the callback may have disabled profiling */
+	if (p == NULL)
+		return;
+	p->countdown = next_interval(p);
+
+	/* find the entry to attribute to, adding one if needed */
+	if (p->num + 1 > p->max / 2 && grow(p) < 0)
+		return;
+	e = lookup(p, fn, kind);
+	if (e->fn == NULL) {
+		e->fn = fn;
+		e->kind = kind;
+		p->num++;
+	}
+
+	/* and account */
+	t = elapsed(&clk->wall, &wall);
+	e->samples++;
+	e->wall += t;
+	e->cpu += elapsed(&clk->cpu, &cpu);
+	e->maxwall = max(e->maxwall, t);
+}
+
+void
+ioprofile_done(struct ioloop *loop)
+{
+	if (loop->profile == NULL)
+		return;
+
+	free(loop->profile->entries);
+	free(loop->profile);
+	loop->profile = NULL;
+}
+
+static int
+compare(const void *a, const void *b)
+{
+	const struct ioprofile_entry *ea = a, *eb = b;
+
+	/* most CPU time first */
+	if (ea->cpu != eb->cpu)
+		return ea->cpu < eb->cpu? 1 : -1;
+
+	return ea->wall < eb->wall? 1 : ea->wall > eb->wall? -1 : 0;
+}
+
+int
+ioloop_profile(struct ioloop *loop, unsigned int rate)
+{
+	struct ioprofile *p;
+
+	/* disable profiling */
+	if (rate == 0) {
+		ioprofile_done(loop);
+		return 0;
+	}
+
+	/* allocate the profile on first use */
+	if ((p = loop->profile) == NULL) {
+		if ((p = calloc(1, sizeof(*p))) == NULL)
+			return -1;
+		p->seed = (uint32_t) (uintptr_t) p | 1;
+		loop->profile = p;
+	}
+
+	p->rate = rate;
+	p->countdown = next_interval(p);
+
+	return 0;
+}
+
+void
+ioloop_profile_dump(struct ioloop *loop, FILE *fp)
+{
+	struct ioprofile	*p = loop->profile;
+	struct ioprofile_entry	*sorted, *e;
+	unsigned int		 i, n;
+	Dl_info			 info;
+	const char		*file;
+
+	if (p == NULL || p->num == 0)
+		return;
+
+	/* collect the entries in use and sort them */
+	if ((sorted = malloc(p->num * sizeof(*sorted))) == NULL)
+		return;
+	for (i = n = 0; i < p->max; i++)
+		if (p->entries[i].fn != NULL)
+			sorted[n++] = p->entries[i];
+	qsort(sorted, n, sizeof(*sorted), compare);
+
+	/* and write them out; totals are estimates */
+	fprintf(fp, "%10s %12s %12s %10s %10s %-7s %s\n", "samples", "cpu ms",
+	    "wall ms", "avg us", "max us", "kind", "callback");
+	for (i = 0; i < n; i++) {
+		e = &sorted[i];
+
+		fprintf(fp, "%10llu %12.3f %12.3f %10.3f %10.3f %-7s ",
+		    (unsigned long long) e->samples,
+		    (double) e->cpu * p->rate / 1e6,
+		    (double) e->wall * p->rate / 1e6,
+		    (double) e->wall / e->samples / 1e3,
+		    (double) e->maxwall / 1e3,
+		    kind_name(e->kind));
+
+		/* resolve the symbol name, if we can */
+		if (dladdr(e->fn, &info) != 0 && info.dli_sname != NULL) {
+			file = strrchr(info.dli_fname, '/');
+			fprintf(fp, "%s+%#lx (%s)\n", info.dli_sname,
+			    (unsigned long) ((uintptr_t) e->fn -
+			    (uintptr_t) info.dli_saddr),
+			    file != NULL? file + 1 : info.dli_fname);
+		} else {
+			fprintf(fp, "%p\n", e->fn);
+		}
+	}
+
+	free(sorted);
+}
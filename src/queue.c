@@ -14,12 +14,23 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
+#include <io/endpoint.h>
+#include <io/pool.h>
 #include <io/queue.h>
 #include "private.h"
 
 #include <stdlib.h>
 #include <limits.h>
 
+#define DRAINSZ		16		/* datagrams per batch when draining */
+
+/* datagrams are only traced by the queue that actually moves them */
+#define QUEUE_PROBE(name, queue, r)                                         \
+	do {                                                                \
+		if (!(queue)->layered)                                      \
+			PROBE3(name, queue, r, r < 0? errno : 0);           \
+	} while (0)
+
 const struct ioparam
 ioqueue_mcast_join = {
 	.name	= "ioqueue_mcast_join"
@@ -41,6 +52,7 @@ ioqueue_free(struct ioqueue *queue)
 	int r;
 
 	r = queue->ops->done(queue);
+	ioendpoint_release(queue->borrowed);
 	free(queue);
 
 	return r;
@@ -95,12 +107,17 @@ ssize_t
 ioqueue_sendv(struct ioqueue *queue, size_t nbufs, const struct iobuf *bufs,
               struct ioendpoint *to)
 {
+	ssize_t r;
+
 	if (queue->ops->send == NULL) {
 		errno = EBADF;
 		return -1;
 	}
 
-	return queue->ops->send(queue, nbufs, bufs, to);
+	r = queue->ops->send(queue, nbufs, bufs, to);
+	QUEUE_PROBE(queue__send, queue, r);
+
+	return r;
 }
 
 ssize_t
@@ -138,16 +155,196 @@ ioqueue_recva(struct ioqueue *queue, struct iobuf *buf,
 	return size;
 }
 
+ssize_t
+ioqueue_recvp(struct ioqueue *queue, struct iopool *pool,
+              struct iopbuf **buf, struct ioendpoint **from)
+{
+	struct iobuf iobuf;
+	ssize_t size;
+
+	if ((*buf = iopbuf_alloc(pool)) == NULL)
+		return -1;
+
+	/* receive straight into the buffer's contents */
+	iobuf.base = (*buf)->base;
+	iobuf.len = (*buf)->len;
+
+	size = ioqueue_recvv(queue, 1, &iobuf, from);
+	if (size < 0) {
+		iopbuf_release(*buf);
+		*buf = NULL;
+		return -1;
+	}
+
+	(*buf)->len = min((size_t) size, iobuf.len);
+
+	return size;
+}
+
 ssize_t
 ioqueue_recvv(struct ioqueue *queue, size_t nbufs, const struct iobuf *bufs,
               struct ioendpoint **from)
 {
+	ssize_t r;
+
 	if (queue->ops->recv == NULL) {
 		errno = EBADF;
 		return -1;
 	}
 
-	return queue->ops->recv(queue, nbufs, bufs, from);
+	r = queue->ops->recv(queue, nbufs, bufs, from);
+	QUEUE_PROBE(queue__recv, queue, r);
+
+	return r;
+}
+
+ssize_t
+ioqueue_recv_borrow(struct ioqueue *queue, size_t nbufs,
+                    const struct iobuf *bufs, struct ioendpoint **from)
+{
+	ssize_t r;
+
+	if (queue->ops->recv_borrow != NULL) {
+		r = queue->ops->recv_borrow(queue, nbufs, bufs, from);
+		QUEUE_PROBE(queue__recv, queue, r);
+
+		return r;
+	}
+
+	/* hold on to a new endpoint for the caller */
+	ioendpoint_release(queue->borrowed);
+	queue->borrowed = NULL;
+
+	r = ioqueue_recvv(queue, nbufs, bufs, &queue->borrowed);
+	if (r >= 0)
+		*from = queue->borrowed;
+
+	return r;
+}
+
+ssize_t
+ioqueue_sendm(struct ioqueue *queue, struct iomsg *msgs, size_t nmsgs)
+{
+	ssize_t r, size;
+	size_t i;
+
+	if (queue->ops->send_batch != NULL) {
+		r = queue->ops->send_batch(queue, msgs, nmsgs);
+		QUEUE_PROBE(queue__sendm, queue, r);
+
+		return r;
+	}
+
+	/* send them one by one; an error is only reported if nothing was
+	 * sent at all, the caller will run into it again otherwise */
+	for (i = 0; i < nmsgs; i++) {
+		size = ioqueue_sendv(queue, msgs[i].nbufs, msgs[i].bufs,
+		    msgs[i].to);
+		if (size < 0)
+			return i > 0? (ssize_t) i : -1;
+		msgs[i].len = size;
+	}
+
+	return i;
+}
+
+ssize_t
+ioqueue_recvm(struct ioqueue *queue, struct iomsg *msgs, size_t nmsgs)
+{
+	ssize_t r, size;
+	size_t i;
+
+	if (queue->ops->recv_batch != NULL) {
+		r = queue->ops->recv_batch(queue, msgs, nmsgs);
+		QUEUE_PROBE(queue__recvm, queue, r);
+
+		return r;
+	}
+
+	/* receive them one by one, only waiting for the first */
+	for (i = 0; i < nmsgs; i++) {
+		if (i > 0 && ioqueue_nextsize(queue) <= 0)
+			break;
+
+		size = ioqueue_recvv(queue, msgs[i].nbufs, msgs[i].bufs,
+		    msgs[i].from);
+		if (size < 0)
+			return i > 0? (ssize_t) i : -1;
+		msgs[i].len = size;
+	}
+
+	return i;
+}
+
+ssize_t
+ioqueue_drain(struct ioqueue *queue, struct iopool *pool, size_t max,
+              ioqueue_drain_cb_t *cb, void *arg)
+{
+	struct iomsg		 msgs[DRAINSZ];
+	struct iobuf		 iobufs[DRAINSZ];
+	struct iopbuf		*bufs[DRAINSZ];
+	struct ioendpoint	*from[DRAINSZ];
+	size_t			 done, n, i;
+	ssize_t			 r;
+
+	for (done = 0; done < max; done += r) {
+		/* set up as many buffers as the pool will give us */
+		for (n = 0; n < min(max - done, DRAINSZ); n++) {
+			if ((bufs[n] = iopbuf_alloc(pool)) == NULL)
+				break;
+
+			iobufs[n].base = bufs[n]->base;
+			iobufs[n].len = bufs[n]->len;
+			msgs[n].bufs = &iobufs[n];
+			msgs[n].nbufs = 1;
+			msgs[n].from = &from[n];
+		}
+		if (n == 0)
+			return done > 0? (ssize_t) done : -1;
+
+		/* receive, and give back what wasn't used */
+		r = ioqueue_recvm(queue, msgs, n);
+		for (i = r > 0? (size_t) r : 0; i < n; i++)
+			iopbuf_release(bufs[i]);
+
+		/* running dry is where draining is supposed to end */
+		if (r < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return done;
+			return done > 0? (ssize_t) done : -1;
+		}
+
+		for (i = 0; i < (size_t) r; i++) {
+			bufs[i]->len = min(msgs[i].len, bufs[i]->len);
+			cb(bufs[i], from[i], arg);
+		}
+
+		if ((size_t) r < n)
+			return done + r;
+	}
+
+	return done;
+}
+
+ssize_t
+ioqueue_send_zc(struct ioqueue *queue, size_t nbufs, const struct iobuf *bufs,
+                struct ioendpoint *to, ioqueue_zc_cb_t *cb, void *arg)
+{
+	ssize_t r;
+
+	if (queue->ops->send_zc != NULL) {
+		r = queue->ops->send_zc(queue, nbufs, bufs, to, cb, arg);
+		QUEUE_PROBE(queue__send_zc, queue, r);
+
+		return r;
+	}
+
+	/* the data was copied, so the buffers are free right away */
+	r = ioqueue_sendv(queue, nbufs, bufs, to);
+	if (r >= 0)
+		cb(true, arg);
+
+	return r;
 }
 
 struct ioevent *
@@ -36,6 +36,8 @@ struct ioqueue_limit {
 	struct ioevent_timer	 timer;		/* rate-limiting timer */
 	struct ioevent		*recv_event,	/* receive event */
 				*send_event;	/* send event */
+	struct ioflag_list	 send_events,	/* events raised on send_ready */
+				 recv_events;	/* events raised on recv_ready */
 	size_t			 send_sec,	/* receive quota for this second */
 				 recv_sec,	/* send quota for this second */
 				 send_rate,	/* receive rate */
@@ -55,6 +57,15 @@ static ssize_t		 limit_send(struct ioqueue *, size_t,
 			     const struct iobuf *, struct ioendpoint *);
 static ssize_t		 limit_recv(struct ioqueue *, size_t,
 			     const struct iobuf *, struct ioendpoint **);
+static ssize_t		 limit_send_batch(struct ioqueue *, struct iomsg *,
+			     size_t);
+static ssize_t		 limit_recv_batch(struct ioqueue *, struct iomsg *,
+			     size_t);
+static ssize_t		 limit_send_zc(struct ioqueue *, size_t,
+			     const struct iobuf *, struct ioendpoint *,
+			     ioqueue_zc_cb_t *, void *);
+static ssize_t		 limit_recv_borrow(struct ioqueue *, size_t,
+			     const struct iobuf *, struct ioendpoint **);
 static struct ioevent	*limit_send_event(struct ioqueue *, ioevent_cb_t *,
 			     void *, enum ioevent_opt);
 static struct ioevent	*limit_recv_event(struct ioqueue *, ioevent_cb_t *,
@@ -81,6 +92,10 @@ limit_ops = {
 	.nextsize	= limit_nextsize,
 	.send		= limit_send,
 	.recv		= limit_recv,
+	.send_batch	= limit_send_batch,
+	.recv_batch	= limit_recv_batch,
+	.send_zc	= limit_send_zc,
+	.recv_borrow	= limit_recv_borrow,
 	.send_event	= limit_send_event,
 	.recv_event	= limit_recv_event,
 	.get		= limit_get,
@@ -95,6 +110,8 @@ limit_done(struct ioqueue *q)
 	limit_stop(queue);
 	ioevent_free((struct ioevent *) queue->send_event);
 	ioevent_free((struct ioevent *) queue->recv_event);
+	ioflag_list_orphan(&queue->send_events);
+	ioflag_list_orphan(&queue->recv_events);
 
 	return ioqueue_free(queue->base);
 }
@@ -186,13 +203,81 @@ limit_recv(struct ioqueue *q, size_t nbufs, const struct iobuf *bufs,
 	return size;
 }
 
+static ssize_t
+limit_send_batch(struct ioqueue *q, struct iomsg *msgs, size_t nmsgs)
+{
+	struct ioqueue_limit *queue = (struct ioqueue_limit *) q;
+	ssize_t n;
+
+	/* the quota is accounted for once for the whole batch */
+	n = ioqueue_sendm(queue->base, msgs, nmsgs);
+	if (n > 0) {
+		queue->send_sec -= min(iomsg_len(msgs, n), queue->send_sec);
+		queue->send_ready = false;
+		limit_trigger(queue);
+	}
+
+	return n;
+}
+
+static ssize_t
+limit_recv_batch(struct ioqueue *q, struct iomsg *msgs, size_t nmsgs)
+{
+	struct ioqueue_limit *queue = (struct ioqueue_limit *) q;
+	ssize_t n;
+
+	n = ioqueue_recvm(queue->base, msgs, nmsgs);
+	if (n > 0) {
+		queue->recv_sec -= min(iomsg_len(msgs, n), queue->recv_sec);
+		queue->recv_ready = false;
+		limit_trigger(queue);
+	}
+
+	return n;
+}
+
+static ssize_t
+limit_send_zc(struct ioqueue *q, size_t nbufs, const struct iobuf *bufs,
+              struct ioendpoint *to, ioqueue_zc_cb_t *cb, void *arg)
+{
+	struct ioqueue_limit *queue = (struct ioqueue_limit *) q;
+	ssize_t size;
+
+	size = ioqueue_send_zc(queue->base, nbufs, bufs, to, cb, arg);
+	if (size > 0) {
+		queue->send_sec -= min((size_t) size, queue->send_sec);
+		queue->send_ready = false;
+		limit_trigger(queue);
+	}
+
+	return size;
+}
+
+static ssize_t
+limit_recv_borrow(struct ioqueue *q, size_t nbufs, const struct iobuf *bufs,
+                  struct ioendpoint **from)
+{
+	struct ioqueue_limit *queue = (struct ioqueue_limit *) q;
+	ssize_t size;
+
+	size = ioqueue_recv_borrow(queue->base, nbufs, bufs, from);
+	if (size > 0) {
+		queue->recv_sec -= min((size_t) size, queue->recv_sec);
+		queue->recv_ready = false;
+		limit_trigger(queue);
+	}
+
+	return size;
+}
+
 static struct ioevent *
 limit_send_event(struct ioqueue *q, ioevent_cb_t *cb, void *arg,
                  enum ioevent_opt opt)
 {
 	struct ioqueue_limit *queue = (struct ioqueue_limit *) q;
 
-	return ioevent_flag(&queue->send_ready, cb, arg, opt);
+	return ioevent_flag_owned(&queue->send_events, &queue->send_ready,
+	    cb, arg, opt);
 }
 
 static struct ioevent *
@@ -201,7 +286,8 @@ limit_recv_event(struct ioqueue *q, ioevent_cb_t *cb, void *arg,
 {
 	struct ioqueue_limit *queue = (struct ioqueue_limit *) q;
 
-	return ioevent_flag(&queue->recv_ready, cb, arg, opt);
+	return ioevent_flag_owned(&queue->recv_events, &queue->recv_ready,
+	    cb, arg, opt);
 }
 
 static int
@@ -313,10 +399,10 @@ limit_writable(int UNUSED(num), void *arg)
 {
 	struct ioqueue_limit *queue = (struct ioqueue_limit *) arg;
 
-	if (queue->send_ready)
-		ioevent_detach(queue->send_event);
-
+	/* keep raising our events for as long as the base queue is
+	 * ready and nobody has acted on it, like a polled flag would */
 	queue->send_ready = true;
+	ioflag_list_raise(&queue->send_events);
 }
 
 static void
@@ -324,10 +410,8 @@ limit_readable(int UNUSED(num), void *arg)
 {
 	struct ioqueue_limit *queue = (struct ioqueue_limit *) arg;
 
-	if (queue->recv_ready)
-		ioevent_detach(queue->recv_event);
-
 	queue->recv_ready = true;
+	ioflag_list_raise(&queue->recv_events);
 }
 
 struct ioqueue *
@@ -341,6 +425,7 @@ ioqueue_alloc_limit(struct ioqueue *base)
 		return NULL;
 
 	queue->queue.ops = &limit_ops;
+	queue->queue.layered = true;
 	queue->base = base;
 
 	queue->send_mark = 1;
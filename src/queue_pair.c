@@ -0,0 +1,471 @@
+/*
+ * Copyright (c) 2011, Wouter Coene <wouter@irdc.nl>
+ * 
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#include <io/event.h>
+#include <io/queue.h>
+#include "private.h"
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#ifdef __linux__
+# include <sys/eventfd.h>
+#endif
+
+#define CACHELINE	64		/* keeps producer and consumer apart */
+
+/*
+ * Ring carrying datagrams in one direction, from a single producer to a
+ * single consumer. Each side only writes its own index and reads the
+ * other's. A wakeup file descriptor signals the consumer that there may
+ * be datagrams, and another signals the producer that there may be room;
+ * each is only written when the ring leaves the state in which the other
+ * side may have found it, and only cleared by the side waiting on it.
+ */
+struct ioring {
+	size_t			 head;		/* next slot to consume */
+	char			 pad1[CACHELINE - sizeof(size_t)];
+	size_t			 tail;		/* next slot to produce */
+	char			 pad2[CACHELINE - sizeof(size_t)];
+	size_t			 mask,		/* number of slots, less one */
+				 stride,	/* size of a slot */
+				 maxsize;	/* largest datagram */
+	int			 data[2],	/* wakeup: there may be data */
+				 room[2];	/* wakeup: there may be room */
+	char			*slots;		/* the slots themselves */
+};
+
+/*
+ * Slot, followed by the datagram
+ */
+struct ioring_slot {
+	size_t			 len;		/* length of the datagram */
+};
+
+/*
+ * State shared by both queues of a pair
+ */
+struct iopair {
+	unsigned int		 refs;		/* queues still using it */
+	struct ioring		 rings[2];	/* one for each direction */
+};
+
+struct ioqueue_pair {
+	struct ioqueue		 queue;
+	struct iopair		*pair;		/* shared state */
+	struct ioring		*tx,		/* ring we produce to */
+				*rx;		/* ring we consume from */
+};
+
+static int		 pair_done(struct ioqueue *);
+static ssize_t		 pair_maxsize(struct ioqueue *);
+static ssize_t		 pair_nextsize(struct ioqueue *);
+static ssize_t		 pair_send(struct ioqueue *, size_t,
+			     const struct iobuf *, struct ioendpoint *);
+static ssize_t		 pair_recv(struct ioqueue *, size_t,
+			     const struct iobuf *, struct ioendpoint **);
+static ssize_t		 pair_send_batch(struct ioqueue *, struct iomsg *,
+			     size_t);
+static struct ioevent	*pair_send_event(struct ioqueue *, ioevent_cb_t *,
+			     void *, enum ioevent_opt);
+static struct ioevent	*pair_recv_event(struct ioqueue *, ioevent_cb_t *,
+			     void *, enum ioevent_opt);
+
+static int		 ring_init(struct ioring *, size_t, size_t);
+static void		 ring_done(struct ioring *);
+static struct ioring_slot
+			*ring_slot(struct ioring *, size_t);
+static bool		 ring_full(struct ioring *, size_t);
+static bool		 ring_empty(struct ioring *);
+static ssize_t		 ring_put(struct ioring *, size_t, size_t,
+			     const struct iobuf *);
+static void		 ring_publish(struct ioring *, size_t);
+
+static int		 wakeup_init(int [2]);
+static void		 wakeup_done(int [2]);
+static void		 wakeup_raise(int [2]);
+static void		 wakeup_clear(int [2]);
+
+static const struct ioqueue_ops
+pair_ops = {
+	.done		= pair_done,
+	.maxsize	= pair_maxsize,
+	.nextsize	= pair_nextsize,
+	.send		= pair_send,
+	.recv		= pair_recv,
+	.send_batch	= pair_send_batch,
+	.send_event	= pair_send_event,
+	.recv_event	= pair_recv_event
+};
+
+static int
+pair_done(struct ioqueue *q)
+{
+	struct ioqueue_pair *queue = (struct ioqueue_pair *) q;
+	struct iopair *pair = queue->pair;
+
+	/* the last one out cleans up */
+	if (atomic_dec(&pair->refs) == 0) {
+		ring_done(&pair->rings[0]);
+		ring_done(&pair->rings[1]);
+		free(pair);
+	}
+
+	return 0;
+}
+
+static ssize_t
+pair_maxsize(struct ioqueue *q)
+{
+	struct ioqueue_pair *queue = (struct ioqueue_pair *) q;
+
+	return queue->tx->maxsize;
+}
+
+static ssize_t
+pair_nextsize(struct ioqueue *q)
+{
+	struct ioqueue_pair *queue = (struct ioqueue_pair *) q;
+
+	if (ring_empty(queue->rx))
+		return 0;
+
+	return ring_slot(queue->rx, queue->rx->head)->len;
+}
+
+static ssize_t
+pair_send(struct ioqueue *q, size_t nbufs, const struct iobuf *bufs,
+          struct ioendpoint *to)
+{
+	struct ioqueue_pair	*queue = (struct ioqueue_pair *) q;
+	struct ioring		*ring = queue->tx;
+	ssize_t			 len;
+
+	/* there's only the other queue to send to */
+	if (to != NULL) {
+		errno = EISCONN;
+		return -1;
+	}
+
+	if ((len = ring_put(ring, ring->tail, nbufs, bufs)) < 0)
+		return -1;
+
+	ring_publish(ring, ring->tail + 1);
+
+	return len;
+}
+
+static ssize_t
+pair_recv(struct ioqueue *q, size_t nbufs, const struct iobuf *bufs,
+          struct ioendpoint **f)
+{
+	struct ioqueue_pair	*queue = (struct ioqueue_pair *) q;
+	struct ioring		*ring = queue->rx;
+	struct ioring_slot	*slot;
+	size_t			 head, i, n, done;
+	char			*p;
+
+	if (ring_empty(ring)) {
+		errno = EAGAIN;
+		return -1;
+	}
+
+	/* copy out as much as fits */
+	head = ring->head;
+	slot = ring_slot(ring, head);
+	p = (char *) (slot + 1);
+	for (i = done = 0; i < nbufs && done < slot->len; i++) {
+		n = min(bufs[i].len, slot->len - done);
+		memcpy(bufs[i].base, p + done, n);
+		done += n;
+	}
+
+	/* hand the slot back; if the producer may have found the ring full,
+	 * tell it there's room now */
+	__atomic_store_n(&ring->head, head + 1, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&ring->tail, __ATOMIC_SEQ_CST) - head > ring->mask)
+		wakeup_raise(ring->room);
+
+	/* there are no endpoints in a pair */
+	if (f != NULL)
+		*f = NULL;
+
+	return done;
+}
+
+static ssize_t
+pair_send_batch(struct ioqueue *q, struct iomsg *msgs, size_t nmsgs)
+{
+	struct ioqueue_pair	*queue = (struct ioqueue_pair *) q;
+	struct ioring		*ring = queue->tx;
+	ssize_t			 len;
+	size_t			 i;
+
+	/* fill as many slots as we can, and publish them all at once */
+	for (i = 0; i < nmsgs; i++) {
+		if (msgs[i].to != NULL) {
+			errno = EISCONN;
+			break;
+		}
+
+		len = ring_put(ring, ring->tail + i, msgs[i].nbufs,
+		    msgs[i].bufs);
+		if (len < 0)
+			break;
+		msgs[i].len = len;
+	}
+
+	if (i == 0)
+		return -1;
+
+	ring_publish(ring, ring->tail + i);
+
+	return i;
+}
+
+static struct ioevent *
+pair_send_event(struct ioqueue *q, ioevent_cb_t *cb, void *arg,
+                enum ioevent_opt opt)
+{
+	struct ioqueue_pair *queue = (struct ioqueue_pair *) q;
+
+	return ioevent_read(queue->tx->room[0], cb, arg, opt);
+}
+
+static struct ioevent *
+pair_recv_event(struct ioqueue *q, ioevent_cb_t *cb, void *arg,
+                enum ioevent_opt opt)
+{
+	struct ioqueue_pair *queue = (struct ioqueue_pair *) q;
+
+	return ioevent_read(queue->rx->data[0], cb, arg, opt);
+}
+
+static int
+ring_init(struct ioring *ring, size_t nslots, size_t maxsize)
+{
+	size_t n;
+
+	for (n = 1; n < nslots; n <<= 1)
+		;
+
+	ring->mask = n - 1;
+	ring->maxsize = maxsize;
+	ring->stride = (sizeof(struct ioring_slot) + maxsize +
+	    sizeof(size_t) - 1) & ~(sizeof(size_t) - 1);
+
+	ring->slots = malloc(n * ring->stride);
+	if (ring->slots == NULL)
+		return -1;
+
+	/* the ring starts out with room, which is what the producer would
+	 * otherwise wait for */
+	if (wakeup_init(ring->data) < 0 || wakeup_init(ring->room) < 0)
+		return -1;
+	wakeup_raise(ring->room);
+
+	return 0;
+}
+
+static void
+ring_done(struct ioring *ring)
+{
+	wakeup_done(ring->data);
+	wakeup_done(ring->room);
+	free(ring->slots);
+}
+
+static struct ioring_slot *
+ring_slot(struct ioring *ring, size_t i)
+{
+	return (struct ioring_slot *) (ring->slots + (i & ring->mask) *
+	    ring->stride);
+}
+
+static bool
+ring_full(struct ioring *ring, size_t tail)
+{
+	size_t head;
+
+	/* full as far as we know; clear our wakeup, then make sure the
+	 * consumer didn't make room before it could see that */
+	head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+	if (tail - head <= ring->mask)
+		return false;
+
+	wakeup_clear(ring->room);
+	head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+
+	return tail - head > ring->mask;
+}
+
+static bool
+ring_empty(struct ioring *ring)
+{
+	size_t tail;
+
+	/* the same, from the consumer's side */
+	tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+	if (tail != ring->head)
+		return false;
+
+	wakeup_clear(ring->data);
+	tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+
+	return tail == ring->head;
+}
+
+static ssize_t
+ring_put(struct ioring *ring, size_t tail, size_t nbufs,
+         const struct iobuf *bufs)
+{
+	struct ioring_slot	*slot;
+	size_t			 i, len;
+	char			*p;
+
+	for (i = len = 0; i < nbufs; i++)
+		len += bufs[i].len;
+	if (len > ring->maxsize) {
+		errno = EMSGSIZE;
+		return -1;
+	}
+
+	if (ring_full(ring, tail)) {
+		errno = EAGAIN;
+		return -1;
+	}
+
+	/* fill in the slot, which the consumer can't see yet */
+	slot = ring_slot(ring, tail);
+	slot->len = len;
+	for (p = (char *) (slot + 1), i = 0; i < nbufs; p += bufs[i++].len)
+		memcpy(p, bufs[i].base, bufs[i].len);
+
+	return len;
+}
+
+static void
+ring_publish(struct ioring *ring, size_t tail)
+{
+	size_t old = ring->tail;
+
+	/* make the slots visible; if the consumer may have found the ring
+	 * empty, wake it up */
+	__atomic_store_n(&ring->tail, tail, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&ring->head, __ATOMIC_SEQ_CST) == old)
+		wakeup_raise(ring->data);
+}
+
+static int
+wakeup_init(int fds[2])
+{
+#ifdef __linux__
+	fds[0] = fds[1] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+	return fds[0] < 0? -1 : 0;
+#else
+	if (pipe(fds) < 0)
+		return -1;
+
+	if (fcntl(fds[0], F_SETFL, O_NONBLOCK) < 0 ||
+	    fcntl(fds[1], F_SETFL, O_NONBLOCK) < 0 ||
+	    fcntl(fds[0], F_SETFD, FD_CLOEXEC) < 0 ||
+	    fcntl(fds[1], F_SETFD, FD_CLOEXEC) < 0)
+		return -1;
+
+	return 0;
+#endif
+}
+
+static void
+wakeup_done(int fds[2])
+{
+	if (fds[1] >= 0 && fds[1] != fds[0])
+		close(fds[1]);
+	if (fds[0] >= 0)
+		close(fds[0]);
+}
+
+static void
+wakeup_raise(int fds[2])
+{
+	uint64_t v = 1;
+
+	/* a full pipe is still readable, so failing is fine */
+	if (write(fds[1], &v, fds[0] == fds[1]? sizeof(v) : 1) < 0)
+		return;
+}
+
+static void
+wakeup_clear(int fds[2])
+{
+	char buf[64];
+
+	while (read(fds[0], buf, sizeof(buf)) > 0 && fds[0] != fds[1])
+		;
+}
+
+int
+ioqueue_alloc_pair(struct ioqueue *queues[2], size_t nslots, size_t maxsize)
+{
+	struct ioqueue_pair	*q[2] = { NULL, NULL };
+	struct iopair		*pair;
+	int			 i;
+
+	if (nslots == 0) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	/* allocate the shared state */
+	pair = calloc(1, sizeof(*pair));
+	if (pair == NULL)
+		return -1;
+
+	pair->refs = 2;
+	for (i = 0; i < 2; i++) {
+		pair->rings[i].data[0] = pair->rings[i].data[1] = -1;
+		pair->rings[i].room[0] = pair->rings[i].room[1] = -1;
+	}
+	if (ring_init(&pair->rings[0], nslots, maxsize) < 0 ||
+	    ring_init(&pair->rings[1], nslots, maxsize) < 0)
+		goto error;
+
+	/* and a queue on either end */
+	for (i = 0; i < 2; i++) {
+		if ((q[i] = calloc(1, sizeof(*q[i]))) == NULL)
+			goto error;
+
+		q[i]->queue.ops = &pair_ops;
+		q[i]->pair = pair;
+		q[i]->tx = &pair->rings[i];
+		q[i]->rx = &pair->rings[1 - i];
+		queues[i] = (struct ioqueue *) q[i];
+	}
+
+	return 0;
+
+error:
+	free(q[0]);
+	free(q[1]);
+	ring_done(&pair->rings[0]);
+	ring_done(&pair->rings[1]);
+	free(pair);
+
+	return -1;
+}
@@ -48,6 +48,15 @@ static ssize_t		 rate_send(struct ioqueue *, size_t,
 			     const struct iobuf *, struct ioendpoint *);
 static ssize_t		 rate_recv(struct ioqueue *, size_t,
 			     const struct iobuf *, struct ioendpoint **);
+static ssize_t		 rate_send_batch(struct ioqueue *, struct iomsg *,
+			     size_t);
+static ssize_t		 rate_recv_batch(struct ioqueue *, struct iomsg *,
+			     size_t);
+static ssize_t		 rate_send_zc(struct ioqueue *, size_t,
+			     const struct iobuf *, struct ioendpoint *,
+			     ioqueue_zc_cb_t *, void *);
+static ssize_t		 rate_recv_borrow(struct ioqueue *, size_t,
+			     const struct iobuf *, struct ioendpoint **);
 static struct ioevent	*rate_send_event(struct ioqueue *, ioevent_cb_t *,
 			     void *, enum ioevent_opt);
 static struct ioevent	*rate_recv_event(struct ioqueue *, ioevent_cb_t *,
@@ -68,6 +77,10 @@ rate_ops = {
 	.nextsize	= rate_nextsize,
 	.send		= rate_send,
 	.recv		= rate_recv,
+	.send_batch	= rate_send_batch,
+	.recv_batch	= rate_recv_batch,
+	.send_zc	= rate_send_zc,
+	.recv_borrow	= rate_recv_borrow,
 	.send_event	= rate_send_event,
 	.recv_event	= rate_recv_event,
 	.get		= rate_get,
@@ -155,6 +168,60 @@ rate_recv(struct ioqueue *q, size_t nbufs, const struct iobuf *bufs,
 	return size;
 }
 
+static ssize_t
+rate_send_batch(struct ioqueue *q, struct iomsg *msgs, size_t nmsgs)
+{
+	struct ioqueue_rate	*queue = (struct ioqueue_rate *) q;
+	ssize_t			 n;
+
+	n = ioqueue_sendm(queue->base, msgs, nmsgs);
+	if (n > 0)
+		queue->send_sec += iomsg_len(msgs, n);
+
+	return n;
+}
+
+static ssize_t
+rate_recv_batch(struct ioqueue *q, struct iomsg *msgs, size_t nmsgs)
+{
+	struct ioqueue_rate	*queue = (struct ioqueue_rate *) q;
+	ssize_t			 n;
+
+	n = ioqueue_recvm(queue->base, msgs, nmsgs);
+	if (n > 0)
+		queue->recv_sec += iomsg_len(msgs, n);
+
+	return n;
+}
+
+static ssize_t
+rate_send_zc(struct ioqueue *q, size_t nbufs, const struct iobuf *bufs,
+             struct ioendpoint *endp, ioqueue_zc_cb_t *cb, void *arg)
+{
+	struct ioqueue_rate	*queue = (struct ioqueue_rate *) q;
+	ssize_t			 size;
+
+	size = ioqueue_send_zc(queue->base, nbufs, bufs, endp, cb, arg);
+	if (size > 0)
+		queue->send_sec += size;
+
+	return size;
+}
+
+static ssize_t
+rate_recv_borrow(struct ioqueue *q, size_t nbufs, const struct iobuf *bufs,
+                 struct ioendpoint **endp)
+{
+	struct ioqueue_rate	*queue = (struct ioqueue_rate *) q;
+	ssize_t			 size;
+
+	size = ioqueue_recv_borrow(queue->base, nbufs, bufs, endp);
+	if (size > 0)
+		queue->recv_sec += size;
+
+	return size;
+}
+
 static struct ioevent *
 rate_send_event(struct ioqueue *q, ioevent_cb_t *cb, void *arg,
                 enum ioevent_opt opt)
@@ -227,6 +294,7 @@ ioqueue_alloc_rate(struct ioqueue *base)
 		return NULL;
 
 	queue->queue.ops = &rate_ops;
+	queue->queue.layered = true;
 	queue->base = base;
 
 	/* set the timer */
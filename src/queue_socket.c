@@ -14,11 +14,15 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
+/* for sendmmsg() and recvmmsg() */
+#define _GNU_SOURCE
+
 #include <io/queue.h>
 #include <io/socket.h>
 #include "private_socket.h"
 
 #include <alloca.h>
+#include <fcntl.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
@@ -28,12 +32,32 @@
 #if defined(AF_INET) || defined(AF_INET6)
 # include <arpa/inet.h>
 # include <netinet/in.h>
+# include <netinet/udp.h>
 #endif
 
 #ifdef AF_UNIX
 # include <sys/un.h>
 #endif
 
+#if defined(SO_ZEROCOPY) && defined(MSG_ZEROCOPY)
+# include <linux/errqueue.h>
+# include <sys/epoll.h>
+# define HAVE_ZEROCOPY
+#endif
+
+#ifdef MSG_WAITFORONE
+# define HAVE_MMSG
+# define BATCHSZ	64		/* datagrams per system call */
+# define BATCHIOV	256		/* buffers per system call */
+#else
+# define BATCHSZ	1		/* datagrams per system call */
+#endif
+
+#define GSO_MAXSEGS	64		/* segments per offloaded send */
+#define GSO_MAXLEN	65000		/* bytes per offloaded send */
+#define GRO_BUFSZ	65536		/* largest coalesced receive */
+#define ZC_REAP_USEC	100000		/* fallback completion reaping interval */
+
 const struct ioparam
 ioqueue_socket_v6only = {
 	.name	= "ioqueue_socket_v6only"
@@ -49,6 +73,31 @@ ioqueue_socket_reuselocal = {
 	.name	= "ioqueue_socket_reuselocal"
 };
 
+const struct ioparam
+ioqueue_socket_gso = {
+	.name	= "ioqueue_socket_gso"
+};
+
+const struct ioparam
+ioqueue_socket_gro = {
+	.name	= "ioqueue_socket_gro"
+};
+
+const struct ioparam
+ioqueue_socket_nonblock = {
+	.name	= "ioqueue_socket_nonblock"
+};
+
+const struct ioparam
+ioqueue_socket_pmtu = {
+	.name	= "ioqueue_socket_pmtu"
+};
+
+const struct ioparam
+ioqueue_socket_segsize = {
+	.name	= "ioqueue_socket_segsize"
+};
+
 /*
  * Socket I/O queue
  */
@@ -56,15 +105,78 @@ struct ioqueue_socket {
 	struct ioqueue	 queue;
 	int		 af;
 	int		 sock;
+	struct ioloop	*loop;		/* I/O loop we're attached to */
+	int		 nonblock;	/* non-blocking: 1 always, -1 never,
+					   0 while attached */
+	bool		 pmtu;		/* path MTU discovery enabled */
+	size_t		 maxsize;	/* cached maximum size, or 0 */
+	size_t		 gso;		/* segment size, or 0 */
+	bool		 gso_kernel;	/* segmentation done by the kernel */
+	enum ioqueue_socket_gro
+			 gro;		/* receive offload mode */
+	size_t		 segsize;	/* segment size of last receive */
+	char		*gro_buf;	/* run being split up */
+	size_t		 gro_len,	/* length of run */
+			 gro_off;	/* offset of next datagram */
+	struct ioendpoint
+			*gro_from;	/* sender of run */
+#ifdef HAVE_ZEROCOPY
+	int		 zc;		/* zero-copy: 0 untried, 1 on, -1 off */
+	struct zcsend	*zc_sends;	/* outstanding sends, by id */
+	size_t		 zc_cap;	/* size of zc_sends, a power of two */
+	uint32_t	 zc_head,	/* id of oldest outstanding send */
+			 zc_next;	/* id of next send */
+	struct ioevent_fd
+			 zc_error;	/* completions are waiting */
+	struct ioevent_timer
+			 zc_timer;	/* reaps any that got past that */
+#endif
+};
+
+/*
+ * Zero-copy send awaiting completion
+ */
+struct zcsend {
+	ioqueue_zc_cb_t	*cb;		/* completion function */
+	void		*arg;		/* argument to cb */
+	bool		 done;		/* completed out of order */
+};
+
+/*
+ * Cursor for slicing a datagram into segments
+ */
+struct cursor {
+	const struct iobuf	*bufs;		/* buffers */
+	size_t			 nbufs,		/* number of buffers */
+				 i,		/* current buffer */
+				 off;		/* offset into current buffer */
 };
 
 static int		 socket_done(struct ioqueue *);
+static int		 socket_attach(struct ioqueue *, struct ioloop *);
+static int		 socket_detach(struct ioqueue *);
 static ssize_t		 socket_maxsize(struct ioqueue *);
+static int		 set_nonblock(struct ioqueue_socket *, bool);
+static int		 pmtu_get(struct ioqueue_socket *, int *);
+static int		 pmtu_enable(struct ioqueue_socket *, bool);
 static ssize_t		 socket_nextsize(struct ioqueue *);
 static ssize_t		 socket_send(struct ioqueue *, size_t,
 			     const struct iobuf *, struct ioendpoint *);
 static ssize_t		 socket_recv(struct ioqueue *, size_t,
 			     const struct iobuf *, struct ioendpoint **);
+static ssize_t		 socket_recv_borrow(struct ioqueue *, size_t,
+			     const struct iobuf *, struct ioendpoint **);
+#ifdef HAVE_MMSG
+static ssize_t		 socket_send_batch(struct ioqueue *, struct iomsg *,
+			     size_t);
+static ssize_t		 socket_recv_batch(struct ioqueue *, struct iomsg *,
+			     size_t);
+#endif
+#ifdef HAVE_ZEROCOPY
+static ssize_t		 socket_send_zc(struct ioqueue *, size_t,
+			     const struct iobuf *, struct ioendpoint *,
+			     ioqueue_zc_cb_t *, void *);
+#endif
 static struct ioevent	*socket_send_event(struct ioqueue *, ioevent_cb_t *,
 			     void *, enum ioevent_opt);
 static struct ioevent	*socket_recv_event(struct ioqueue *, ioevent_cb_t *,
@@ -74,13 +186,34 @@ static int		 socket_get(struct ioqueue *,
 static int		 socket_set(struct ioqueue *,
 			     const struct ioparam *, uintptr_t);
 
+#ifdef HAVE_ZEROCOPY
+static int		 zc_open(struct ioqueue_socket *);
+static int		 zc_arm(struct ioqueue_socket *);
+static void		 zc_disarm(struct ioqueue_socket *);
+static size_t		 zc_reap(struct ioqueue_socket *);
+static bool		 zc_spurious(struct ioqueue_socket *);
+static void		 zc_error(int, void *);
+static void		 zc_timer(int, void *);
+static int		 zc_grow(struct ioqueue_socket *);
+#endif
+
 static const struct ioqueue_ops
 socket_ops = {
 	.done		= socket_done,
+	.attach		= socket_attach,
+	.detach		= socket_detach,
 	.maxsize	= socket_maxsize,
 	.nextsize	= socket_nextsize,
 	.send		= socket_send,
 	.recv		= socket_recv,
+#ifdef HAVE_MMSG
+	.send_batch	= socket_send_batch,
+	.recv_batch	= socket_recv_batch,
+#endif
+#ifdef HAVE_ZEROCOPY
+	.send_zc	= socket_send_zc,
+#endif
+	.recv_borrow	= socket_recv_borrow,
 	.send_event	= socket_send_event,
 	.recv_event	= socket_recv_event,
 	.get		= socket_get,
@@ -92,6 +225,16 @@ socket_done(struct ioqueue *q)
 {
 	struct ioqueue_socket *queue = (struct ioqueue_socket *) q;
 
+	free(queue->gro_buf);
+	ioendpoint_release(queue->gro_from);
+#ifdef HAVE_ZEROCOPY
+	ioevent_detach((struct ioevent *) &queue->zc_error);
+	ioevent_detach((struct ioevent *) &queue->zc_timer);
+	if (queue->zc_error.fd >= 0)
+		close(queue->zc_error.fd);
+	free(queue->zc_sends);
+#endif
+
 	return close(queue->sock);
 }
 
@@ -102,19 +245,105 @@ socket_maxsize(struct ioqueue *q)
 	int			 val;
 	socklen_t		 len;
 
+	if (queue->maxsize != 0)
+		return queue->maxsize;
+
+	/* with path MTU discovery, the path decides; that's only known once
+	 * the socket is connected */
+	if (queue->pmtu && pmtu_get(queue, &val) == 0) {
+		queue->maxsize = val;
+		return val;
+	}
+
 	len = sizeof(val);
 	if (getsockopt(queue->sock, SOL_SOCKET, SO_SNDBUF, &val, &len) < 0)
 		return -1;
 
+	queue->maxsize = val;
+
 	return val;
 }
 
+static int
+pmtu_get(struct ioqueue_socket *queue, int *size)
+{
+	socklen_t len = sizeof(*size);
+
+	/* take off the IP and UDP headers */
+	switch (queue->af) {
+#if defined(AF_INET) && defined(IP_MTU)
+	case AF_INET:
+		if (getsockopt(queue->sock, IPPROTO_IP, IP_MTU, size, &len) < 0)
+			return -1;
+
+		*size -= 20 + 8;
+		return 0;
+#endif
+
+#if defined(AF_INET6) && defined(IPV6_MTU)
+	case AF_INET6:
+		if (getsockopt(queue->sock, IPPROTO_IPV6, IPV6_MTU, size,
+		               &len) < 0)
+			return -1;
+
+		*size -= 40 + 8;
+		return 0;
+#endif
+	}
+
+	errno = ENOTSUP;
+
+	return -1;
+}
+
+static int
+pmtu_enable(struct ioqueue_socket *queue, bool enable)
+{
+	int v = -1;
+
+	/* have the kernel set the don't-fragment bit and track the path
+	 * MTU, or go back to its default */
+	switch (queue->af) {
+#if defined(AF_INET) && defined(IP_MTU_DISCOVER)
+	case AF_INET:
+		v = enable? IP_PMTUDISC_DO : IP_PMTUDISC_WANT;
+		if (setsockopt(queue->sock, IPPROTO_IP, IP_MTU_DISCOVER,
+		               &v, sizeof(v)) < 0)
+			return -1;
+		break;
+#endif
+
+#if defined(AF_INET6) && defined(IPV6_MTU_DISCOVER)
+	case AF_INET6:
+		v = enable? IPV6_PMTUDISC_DO : IPV6_PMTUDISC_WANT;
+		if (setsockopt(queue->sock, IPPROTO_IPV6, IPV6_MTU_DISCOVER,
+		               &v, sizeof(v)) < 0)
+			return -1;
+		break;
+#endif
+	}
+
+	if (v < 0) {
+		errno = ENOTSUP;
+		return -1;
+	}
+
+	queue->pmtu = enable;
+	queue->maxsize = 0;
+
+	return 0;
+}
+
 static ssize_t
 socket_nextsize(struct ioqueue *q)
 {
 	struct ioqueue_socket	*queue = (struct ioqueue_socket *) q;
 	int			 val;
 
+	/* datagrams held back from a run come first */
+	if (queue->gro_off < queue->gro_len)
+		return min(queue->segsize, queue->gro_len - queue->gro_off);
+
 	val = 0;
 	if (ioctl(queue->sock, FIONREAD, &val) < 0)
 		return -1;
@@ -122,14 +351,378 @@ socket_nextsize(struct ioqueue *q)
 	return val;
 }
 
+static struct ioendpoint_socket *
+endpoint_to(struct ioendpoint *t, struct ioendpoint_socket *tmp)
+{
+	struct ioendpoint_socket *to;
+
+	/* socket endpoints are used as they are */
+	if (t == NULL || t->ops == &ioendpoint_socket_ops)
+		return (struct ioendpoint_socket *) t;
+
+	/* compact ones are filled in on the stack */
+	if (ioendpoint_inet_sockaddr(t, &tmp->addr, &tmp->addrlen) == 0) {
+		tmp->endpoint.ops = NULL;
+		return tmp;
+	}
+
+	/* convert endpoint address */
+	to = (struct ioendpoint_socket *)
+	    ioendpoint_convert(t, &ioendpoint_socket_ops);
+	if (to == NULL)
+		errno = EAFNOSUPPORT;
+
+	return to;
+}
+
+static void
+endpoint_to_done(struct ioendpoint *t, struct ioendpoint_socket *to)
+{
+	if ((struct ioendpoint *) to != t && to->endpoint.ops != NULL)
+		ioendpoint_release((struct ioendpoint *) to);
+}
+
+static struct ioendpoint *
+endpoint_from(struct ioqueue_socket *queue, struct sockaddr_storage *addr,
+              socklen_t addrlen)
+{
+	struct ioendpoint_socket *from;
+
+	iosockaddr_trim(addr, addrlen);
+
+	/* the same sender always gets the same endpoint from a loop */
+	if (queue->loop != NULL)
+		return (struct ioendpoint *)
+		    iointern_get(queue->loop, addr, addrlen);
+
+	/* otherwise, create a new one */
+	from = (struct ioendpoint_socket *)
+	    ioendpoint_alloc(&ioendpoint_socket_ops);
+	if (from != NULL) {
+		memcpy(&from->addr, addr, addrlen);
+		from->addrlen = addrlen;
+	}
+
+	return (struct ioendpoint *) from;
+}
+
+static size_t
+cursor_take(struct cursor *c, size_t len, struct iovec *iov, size_t *niov)
+{
+	size_t taken, n;
+
+	/* take up to len bytes from the buffers */
+	for (taken = 0; taken < len && c->i < c->nbufs; ) {
+		n = min(len - taken, c->bufs[c->i].len - c->off);
+		if (n != 0) {
+			iov[*niov].iov_base = (char *) c->bufs[c->i].base + c->off;
+			iov[*niov].iov_len = n;
+			(*niov)++;
+		}
+
+		taken += n;
+		c->off += n;
+		if (c->off == c->bufs[c->i].len) {
+			c->i++;
+			c->off = 0;
+		}
+	}
+
+	return taken;
+}
+
+static int
+gso_enable(struct ioqueue_socket *queue, size_t size)
+{
+	/* reject sizes that can't be a datagram */
+	if (size > GSO_MAXLEN) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	queue->gso = size;
+	queue->gso_kernel = false;
+
+	/* try to have the kernel do it; if it can't, we do it ourselves */
+#ifdef UDP_SEGMENT
+	if (queue->af == AF_INET || queue->af == AF_INET6) {
+		int v = (int) size;
+
+		if (setsockopt(queue->sock, SOL_UDP, UDP_SEGMENT, &v,
+		    sizeof(v)) == 0)
+			queue->gso_kernel = size != 0;
+	}
+#endif
+
+	return 0;
+}
+
+static ssize_t
+gso_send(struct ioqueue_socket *queue, size_t nbufs, const struct iobuf *bufs,
+         struct ioendpoint_socket *to, size_t len)
+{
+	struct cursor	 c;
+	struct iovec	*iov;
+	size_t		 sent, chunk, niov;
+	ssize_t		 r;
+#ifdef HAVE_MMSG
+	struct mmsghdr	 hdrs[BATCHSZ];
+	size_t		 n, i;
+#else
+	struct msghdr	 msghdr;
+#endif
+
+#ifdef UDP_SEGMENT
+again:
+#endif
+	/* with segmentation offload, we hand the kernel as many segments
+	 * at once as it takes; otherwise, one at a time */
+	chunk = queue->gso;
+	if (queue->gso_kernel)
+		chunk *= max(1, min(GSO_MAXSEGS, GSO_MAXLEN / queue->gso));
+
+	/* a segment boundary splits at most one buffer */
+	iov = alloca((nbufs + BATCHSZ) * sizeof(*iov));
+	c.bufs = bufs;
+	c.nbufs = nbufs;
+	c.i = c.off = 0;
+
+	for (sent = 0; sent < len; ) {
+#ifdef HAVE_MMSG
+		/* set up a batch of segments */
+		for (n = niov = 0; n < BATCHSZ && c.i < c.nbufs; n++) {
+			memset(&hdrs[n], '\0', sizeof(hdrs[n]));
+			if (to != NULL) {
+				hdrs[n].msg_hdr.msg_name = &to->addr;
+				hdrs[n].msg_hdr.msg_namelen = to->addrlen;
+			}
+			hdrs[n].msg_hdr.msg_iov = &iov[niov];
+			i = niov;
+			if (cursor_take(&c, chunk, iov, &niov) == 0)
+				break;
+			hdrs[n].msg_hdr.msg_iovlen = niov - i;
+		}
+
+		r = sendmmsg(queue->sock, hdrs, n, 0);
+#else
+		/* set up a single segment */
+		memset(&msghdr, '\0', sizeof(msghdr));
+		if (to != NULL) {
+			msghdr.msg_name = &to->addr;
+			msghdr.msg_namelen = to->addrlen;
+		}
+		msghdr.msg_iov = iov;
+		niov = 0;
+		cursor_take(&c, chunk, iov, &niov);
+		msghdr.msg_iovlen = niov;
+
+		r = sendmsg(queue->sock, &msghdr, 0);
+#endif
+
+		/* the device may not be up to offloading after all, in which
+		 * case we fall back to segmenting ourselves */
+#ifdef UDP_SEGMENT
+		if (r < 0 && errno == EIO && queue->gso_kernel && sent == 0) {
+			int v = 0;
+
+			setsockopt(queue->sock, SOL_UDP, UDP_SEGMENT, &v,
+			    sizeof(v));
+			queue->gso_kernel = false;
+			goto again;
+		}
+#endif
+		if (r < 0)
+			return sent > 0? (ssize_t) sent : -1;
+
+#ifdef HAVE_MMSG
+		for (i = 0; i < (size_t) r; i++)
+			sent += hdrs[i].msg_len;
+		if ((size_t) r < n)
+			break;
+#else
+		sent += r;
+#endif
+	}
+
+	return sent;
+}
+
+static int
+gro_enable(struct ioqueue_socket *queue, enum ioqueue_socket_gro mode)
+{
+	switch (mode) {
+	case IOQUEUE_SOCKET_GRO_OFF:
+	case IOQUEUE_SOCKET_GRO_COALESCE:
+		break;
+
+	case IOQUEUE_SOCKET_GRO_SPLIT:
+		/* allocate a buffer to hold a run */
+		if (queue->gro_buf == NULL &&
+		    (queue->gro_buf = malloc(GRO_BUFSZ)) == NULL)
+			return -1;
+		break;
+
+	default:
+		errno = EINVAL;
+		return -1;
+	}
+
+	/* datagrams held back are still handed up after switching off */
+	queue->gro = mode;
+
+	/* whether the kernel can coalesce is only known when receiving */
+#ifdef UDP_GRO
+	if (queue->af == AF_INET || queue->af == AF_INET6) {
+		int v = mode != IOQUEUE_SOCKET_GRO_OFF;
+
+		setsockopt(queue->sock, SOL_UDP, UDP_GRO, &v, sizeof(v));
+	}
+#endif
+
+	return 0;
+}
+
+static size_t
+gro_copy(size_t nbufs, const struct iobuf *bufs, const char *data, size_t len)
+{
+	size_t i, n, done;
+
+	/* copy as much as fits, dropping the rest like a receive would */
+	for (i = done = 0; i < nbufs && done < len; i++) {
+		n = min(bufs[i].len, len - done);
+		memcpy(bufs[i].base, data + done, n);
+		done += n;
+	}
+
+	return done;
+}
+
+static ssize_t
+gro_recv(struct ioqueue_socket *queue, size_t nbufs, const struct iobuf *bufs,
+         struct ioendpoint **f)
+{
+	struct ioendpoint		*from;
+	struct sockaddr_storage		 addr;
+	struct msghdr			 msghdr;
+	struct iovec			*iov, one;
+	struct cmsghdr			*cmsg;
+	size_t				 i, n;
+	ssize_t				 size;
+	union {
+		char			 buf[CMSG_SPACE(sizeof(int))];
+		struct cmsghdr		 align;
+	}				 control;
+
+	/* hand up the next datagram of a run */
+	if (queue->gro_off < queue->gro_len)
+		goto split;
+
+	/* receive into the run buffer when splitting, or straight into
+	 * the caller's buffers otherwise */
+	if (queue->gro == IOQUEUE_SOCKET_GRO_SPLIT) {
+		one.iov_base = queue->gro_buf;
+		one.iov_len = GRO_BUFSZ;
+		iov = &one;
+		n = 1;
+	} else {
+		iov = alloca(nbufs * sizeof(*iov));
+		for (i = 0; i < nbufs; i++) {
+			iov[i].iov_base = bufs[i].base;
+			iov[i].iov_len = bufs[i].len;
+		}
+		n = nbufs;
+	}
+
+	/* set up the message header */
+	memset(&msghdr, '\0', sizeof(msghdr));
+	msghdr.msg_name = &addr;
+	msghdr.msg_namelen = sizeof(addr);
+	msghdr.msg_iov = iov;
+	msghdr.msg_iovlen = n;
+	msghdr.msg_control = control.buf;
+	msghdr.msg_controllen = sizeof(control.buf);
+
+	/* perform the receive */
+	size = recvmsg(queue->sock, &msghdr, 0);
+	if (size < 0)
+		return -1;
+
+	/* find the endpoint for the sender address, which a run needs
+	 * even if the caller doesn't */
+	from = NULL;
+	if ((f != NULL || queue->gro == IOQUEUE_SOCKET_GRO_SPLIT) &&
+	    (from = endpoint_from(queue, &addr, msghdr.msg_namelen)) == NULL)
+		return -1;
+
+	/* find the segment size of a coalesced run */
+	queue->segsize = size;
+#ifdef UDP_GRO
+	for (cmsg = CMSG_FIRSTHDR(&msghdr); cmsg != NULL;
+	     cmsg = CMSG_NXTHDR(&msghdr, cmsg)) {
+		int v;
+
+		if (cmsg->cmsg_level != SOL_UDP || cmsg->cmsg_type != UDP_GRO)
+			continue;
+
+		memcpy(&v, CMSG_DATA(cmsg), sizeof(v));
+		if (v > 0 && v < size)
+			queue->segsize = v;
+	}
+#else
+	(void) cmsg;
+#endif
+
+	if (queue->gro != IOQUEUE_SOCKET_GRO_SPLIT) {
+		if (f != NULL)
+			*f = from;
+
+		return size;
+	}
+
+	/* keep the run around */
+	ioendpoint_release(queue->gro_from);
+	queue->gro_from = from;
+	queue->gro_len = size;
+	queue->gro_off = 0;
+
+split:
+	n = min(queue->segsize, queue->gro_len - queue->gro_off);
+	size = gro_copy(nbufs, bufs, queue->gro_buf + queue->gro_off, n);
+	queue->gro_off += n;
+
+	if (f != NULL)
+		*f = ioendpoint_retain(queue->gro_from);
+
+	return size;
+}
+
 static ssize_t
 socket_send(struct ioqueue *q, size_t nbufs, const struct iobuf *bufs,
             struct ioendpoint *t)
 {
-	struct ioqueue_socket	*queue = (struct ioqueue_socket *) q;
-	struct iovec		*iov;
-	size_t			 i;
-	ssize_t			 size;
+	struct ioqueue_socket		*queue = (struct ioqueue_socket *) q;
+	struct ioendpoint_socket	*to, tmp;
+	struct iovec			*iov;
+	struct msghdr			 msghdr;
+	size_t				 i, len;
+	ssize_t				 size;
+
+	/* datagrams larger than the segment size are split up */
+	if (queue->gso != 0) {
+		for (i = len = 0; i < nbufs; i++)
+			len += bufs[i].len;
+
+		if (len > queue->gso) {
+			to = endpoint_to(t, &tmp);
+			if (t != NULL && to == NULL)
+				return -1;
+
+			size = gso_send(queue, nbufs, bufs, to, len);
+			endpoint_to_done(t, to);
+
+			goto done;
+		}
+	}
 
 	/* convert buffers */
 	iov = alloca(nbufs * sizeof(*iov));
@@ -138,34 +731,32 @@ socket_send(struct ioqueue *q, size_t nbufs, const struct iobuf *bufs,
 		iov[i].iov_len = bufs[i].len;
 	}
 
-	if (t != NULL) {
-		struct ioendpoint_socket *to;
-		struct msghdr msghdr;
+	/* perform the send */
+	if (t == NULL) {
+		size = writev(queue->sock, iov, nbufs);
+		goto done;
+	}
 
-		/* convert endpoint address */
-		to = (struct ioendpoint_socket *)
-		    ioendpoint_convert(t, &ioendpoint_socket_ops);
-		if (to == NULL) {
-			errno = EAFNOSUPPORT;
-			return -1;
-		}
+	if ((to = endpoint_to(t, &tmp)) == NULL)
+		return -1;
 
-		/* set up the message header */
-		memset(&msghdr, '\0', sizeof(msghdr));
-		msghdr.msg_name = &to->addr;
-		msghdr.msg_namelen = to->addrlen;
-		msghdr.msg_iov = iov;
-		msghdr.msg_iovlen = nbufs;
+	/* set up the message header */
+	memset(&msghdr, '\0', sizeof(msghdr));
+	msghdr.msg_name = &to->addr;
+	msghdr.msg_namelen = to->addrlen;
+	msghdr.msg_iov = iov;
+	msghdr.msg_iovlen = nbufs;
 
-		/* perform the send */
-		size = sendmsg(queue->sock, &msghdr, 0);
+	/* perform the send */
+	size = sendmsg(queue->sock, &msghdr, 0);
 
-		/* release the endpoint address */
-		ioendpoint_release((struct ioendpoint *) to);
-	} else {
-		/* perform the send */
-		size = writev(queue->sock, iov, nbufs);
-	}
+	/* release the endpoint address */
+	endpoint_to_done(t, to);
+
+done:
+	/* the path got narrower; look up the new size when asked */
+	if (size < 0 && errno == EMSGSIZE)
+		queue->maxsize = 0;
 
 	return size;
 }
@@ -175,10 +766,26 @@ socket_recv(struct ioqueue *q, size_t nbufs, const struct iobuf *bufs,
             struct ioendpoint **f)
 {
 	struct ioqueue_socket	*queue = (struct ioqueue_socket *) q;
+	struct sockaddr_storage	 addr;
+	struct msghdr		 msghdr;
 	struct iovec		*iov;
 	size_t			 i;
 	ssize_t			 size;
 
+#ifdef HAVE_ZEROCOPY
+	/* completions make the socket look readable, so if that's all
+	 * there was, don't wait for a datagram */
+	if (zc_spurious(queue)) {
+		errno = EAGAIN;
+		return -1;
+	}
+#endif
+
+	/* runs coalesced by receive offload need the segment size */
+	if (queue->gro != IOQUEUE_SOCKET_GRO_OFF ||
+	    queue->gro_off < queue->gro_len)
+		return gro_recv(queue, nbufs, bufs, f);
+
 	/* convert buffers */
 	iov = alloca(nbufs * sizeof(*iov));
 	for (i = 0; i < nbufs; i++) {
@@ -186,62 +793,610 @@ socket_recv(struct ioqueue *q, size_t nbufs, const struct iobuf *bufs,
 		iov[i].iov_len = bufs[i].len;
 	}
 
-	if (f != NULL) {
-		struct ioendpoint_socket *from;
-		struct msghdr msghdr;
+	/* perform the receive */
+	if (f == NULL)
+		return readv(queue->sock, iov, nbufs);
 
-		/* create the endpoint to hold the sender address */
-		from = (struct ioendpoint_socket *)
-		    ioendpoint_alloc(&ioendpoint_socket_ops);
-		if (from == NULL)
-			return -1;
+	/* set up the message header */
+	memset(&msghdr, '\0', sizeof(msghdr));
+	msghdr.msg_name = &addr;
+	msghdr.msg_namelen = sizeof(addr);
+	msghdr.msg_iov = iov;
+	msghdr.msg_iovlen = nbufs;
 
-		/* set up the message header */
-		memset(&msghdr, '\0', sizeof(msghdr));
-		msghdr.msg_name = &from->addr;
-		msghdr.msg_namelen = sizeof(from->addr);
-		msghdr.msg_iov = iov;
-		msghdr.msg_iovlen = nbufs;
+	/* perform the receive */
+	size = recvmsg(queue->sock, &msghdr, 0);
+	if (size < 0)
+		return -1;
+
+	/* find the endpoint for the sender address */
+	if ((*f = endpoint_from(queue, &addr, msghdr.msg_namelen)) == NULL)
+		return -1;
+
+	return size;
+}
+
+static ssize_t
+socket_recv_borrow(struct ioqueue *q, size_t nbufs, const struct iobuf *bufs,
+                   struct ioendpoint **f)
+{
+	struct ioqueue_socket		*queue = (struct ioqueue_socket *) q;
+	struct ioendpoint_socket	*from;
+	struct sockaddr_storage		 addr;
+	struct msghdr			 msghdr;
+	struct iovec			*iov;
+	size_t				 i;
+	ssize_t				 size;
+
+	/* receive offload and zero-copy completions have their own ways
+	 * of receiving, which hand out a new endpoint */
+	if (queue->gro != IOQUEUE_SOCKET_GRO_OFF ||
+	    queue->gro_off < queue->gro_len
+#ifdef HAVE_ZEROCOPY
+	    || queue->zc_head != queue->zc_next
+#endif
+	    ) {
+		ioendpoint_release(q->borrowed);
+		q->borrowed = NULL;
+
+		size = socket_recv(q, nbufs, bufs, &q->borrowed);
+		if (size >= 0)
+			*f = q->borrowed;
+
+		return size;
+	}
 
-		/* perform the receive */
-		size = recvmsg(queue->sock, &msghdr, 0);
-		if (size < 0) {
-			ioendpoint_release((struct ioendpoint *) from);
+	/* convert buffers */
+	iov = alloca(nbufs * sizeof(*iov));
+	for (i = 0; i < nbufs; i++) {
+		iov[i].iov_base = bufs[i].base;
+		iov[i].iov_len = bufs[i].len;
+	}
+
+	/* set up the message header */
+	memset(&msghdr, '\0', sizeof(msghdr));
+	msghdr.msg_name = &addr;
+	msghdr.msg_namelen = sizeof(addr);
+	msghdr.msg_iov = iov;
+	msghdr.msg_iovlen = nbufs;
+
+	/* perform the receive */
+	size = recvmsg(queue->sock, &msghdr, 0);
+	if (size < 0)
+		return -1;
+	iosockaddr_trim(&addr, msghdr.msg_namelen);
+
+	/* the same sender as last time gets the same endpoint */
+	from = (struct ioendpoint_socket *) q->borrowed;
+	if (from != NULL && from->addrlen == msghdr.msg_namelen &&
+	    memcmp(&from->addr, &addr, from->addrlen) == 0) {
+		*f = q->borrowed;
+		return size;
+	}
+
+	/* otherwise, reuse it if nobody else holds on to it, unless the
+	 * loop's table has it or another thread has seen it */
+	if (from != NULL && from->endpoint.refs == 1 && from->intern == NULL &&
+	    !from->endpoint.shared && queue->loop == NULL) {
+		free(from->endpoint.str);
+		from->endpoint.str = NULL;
+	} else {
+		ioendpoint_release(q->borrowed);
+		q->borrowed = endpoint_from(queue, &addr, msghdr.msg_namelen);
+		if (q->borrowed == NULL)
 			return -1;
+
+		*f = q->borrowed;
+		return size;
+	}
+
+	memcpy(&from->addr, &addr, msghdr.msg_namelen);
+	from->addrlen = msghdr.msg_namelen;
+	iosockaddr_trim(&from->addr, from->addrlen);
+	*f = q->borrowed;
+
+	return size;
+}
+
+#ifdef HAVE_MMSG
+static ssize_t
+socket_send_batch(struct ioqueue *q, struct iomsg *msgs, size_t nmsgs)
+{
+	struct ioqueue_socket		*queue = (struct ioqueue_socket *) q;
+	struct mmsghdr			 hdrs[BATCHSZ];
+	struct iovec			 iov[BATCHIOV];
+	struct ioendpoint_socket	*to[BATCHSZ], tmp[BATCHSZ];
+	struct iomsg			*msg;
+	size_t				 done, n, niov, i;
+	ssize_t				 size;
+	int				 r;
+
+	for (done = 0; done < nmsgs; done += r) {
+		/* set up as many messages as we can take at once */
+		for (n = niov = 0; done + n < nmsgs && n < BATCHSZ; n++) {
+			msg = &msgs[done + n];
+			if (niov + msg->nbufs > BATCHIOV)
+				break;
+
+			/* convert endpoint address */
+			to[n] = NULL;
+			if (msg->to != NULL &&
+			    (to[n] = endpoint_to(msg->to, &tmp[n])) == NULL)
+				break;
+
+			/* set up the message header */
+			memset(&hdrs[n], '\0', sizeof(hdrs[n]));
+			if (to[n] != NULL) {
+				hdrs[n].msg_hdr.msg_name = &to[n]->addr;
+				hdrs[n].msg_hdr.msg_namelen = to[n]->addrlen;
+			}
+			hdrs[n].msg_hdr.msg_iov = &iov[niov];
+			hdrs[n].msg_hdr.msg_iovlen = msg->nbufs;
+
+			/* convert buffers */
+			for (i = 0; i < msg->nbufs; i++, niov++) {
+				iov[niov].iov_base = msg->bufs[i].base;
+				iov[niov].iov_len = msg->bufs[i].len;
+			}
 		}
 
-		/* set the address length of the address */
-		switch (from->addr.ss_family) {
-#ifdef AF_INET
-		case AF_INET:
-			from->addrlen = sizeof(struct sockaddr_in);
-			break;
+		/* nothing could be set up; either the endpoint is bad, or
+		 * there are too many buffers, in which case the datagram is
+		 * sent on its own */
+		if (n == 0) {
+			msg = &msgs[done];
+			if (niov + msg->nbufs <= BATCHIOV)
+				return done > 0? (ssize_t) done : -1;
+
+			size = socket_send(q, msg->nbufs, msg->bufs, msg->to);
+			if (size < 0)
+				return done > 0? (ssize_t) done : -1;
+
+			msg->len = size;
+			r = 1;
+			continue;
+		}
+
+		/* perform the send and release the endpoint addresses */
+		r = sendmmsg(queue->sock, hdrs, n, 0);
+		for (i = 0; i < n; i++)
+			endpoint_to_done(msgs[done + i].to, to[i]);
+		if (r < 0) {
+			if (errno == EMSGSIZE)
+				queue->maxsize = 0;
+			return done > 0? (ssize_t) done : -1;
+		}
+
+		for (i = 0; i < (size_t) r; i++)
+			msgs[done + i].len = hdrs[i].msg_len;
+
+		/* stop if the socket didn't take everything */
+		if ((size_t) r < n)
+			return done + r;
+	}
+
+	return done;
+}
+
+static ssize_t
+socket_recv_batch(struct ioqueue *q, struct iomsg *msgs, size_t nmsgs)
+{
+	struct ioqueue_socket		*queue = (struct ioqueue_socket *) q;
+	struct mmsghdr			 hdrs[BATCHSZ];
+	struct iovec			 iov[BATCHIOV];
+	struct sockaddr_storage		 names[BATCHSZ];
+	struct iomsg			*msg;
+	size_t				 done, n, niov, i;
+	ssize_t				 size;
+	int				 r;
+
+	/* with receive offload, each receive already takes a whole run,
+	 * but needs its own segment size */
+	if (queue->gro != IOQUEUE_SOCKET_GRO_OFF ||
+	    queue->gro_off < queue->gro_len) {
+		for (done = 0; done < nmsgs; done++) {
+			msg = &msgs[done];
+			if (done > 0 && socket_nextsize(q) <= 0)
+				break;
+
+			size = gro_recv(queue, msg->nbufs, msg->bufs,
+			    msg->from);
+			if (size < 0)
+				return done > 0? (ssize_t) done : -1;
+			msg->len = size;
+		}
+
+		return done;
+	}
+
+	for (done = 0; done < nmsgs; done += r) {
+		/* set up as many messages as we can take at once */
+		for (n = niov = 0; done + n < nmsgs && n < BATCHSZ; n++) {
+			msg = &msgs[done + n];
+			if (niov + msg->nbufs > BATCHIOV)
+				break;
+
+			/* set up the message header */
+			memset(&hdrs[n], '\0', sizeof(hdrs[n]));
+			if (msg->from != NULL) {
+				hdrs[n].msg_hdr.msg_name = &names[n];
+				hdrs[n].msg_hdr.msg_namelen = sizeof(names[n]);
+			}
+			hdrs[n].msg_hdr.msg_iov = &iov[niov];
+			hdrs[n].msg_hdr.msg_iovlen = msg->nbufs;
+
+			/* convert buffers */
+			for (i = 0; i < msg->nbufs; i++, niov++) {
+				iov[niov].iov_base = msg->bufs[i].base;
+				iov[niov].iov_len = msg->bufs[i].len;
+			}
+		}
+
+		/* nothing could be set up, as there are too many buffers, so
+		 * the datagram is received on its own if there is one */
+		if (n == 0) {
+			msg = &msgs[done];
+			if (done > 0 && socket_nextsize(q) <= 0)
+				return done;
+
+			size = socket_recv(q, msg->nbufs, msg->bufs, msg->from);
+			if (size < 0)
+				return done > 0? (ssize_t) done : -1;
+
+			msg->len = size;
+			r = 1;
+			continue;
+		}
+
+		/* perform the receive; only the very first datagram is
+		 * waited for */
+		r = recvmmsg(queue->sock, hdrs, n,
+		    done == 0? MSG_WAITFORONE : MSG_DONTWAIT, NULL);
+
+		if (r < 0)
+			return done > 0? (ssize_t) done : -1;
+
+		/* hand out the sender endpoints; if we're out of memory, the
+		 * datagram is still handed up, just without one */
+		for (i = 0; i < (size_t) r; i++) {
+			msg = &msgs[done + i];
+			msg->len = hdrs[i].msg_len;
+			if (msg->from != NULL)
+				*msg->from = endpoint_from(queue, &names[i],
+				    hdrs[i].msg_hdr.msg_namelen);
+		}
+
+		/* stop if there was no more */
+		if ((size_t) r < n)
+			return done + r;
+	}
+
+	return done;
+}
+#endif /* HAVE_MMSG */
+
+static int
+socket_attach(struct ioqueue *q, struct ioloop *loop)
+{
+	struct ioqueue_socket *queue = (struct ioqueue_socket *) q;
+
+	/* prevent duplicate attachment */
+	if (queue->loop != NULL) {
+		errno = EBUSY;
+		return -1;
+	}
+
+	/* a loop must never block on a queue, so unless told otherwise, go
+	 * non-blocking while attached */
+	if (queue->nonblock == 0 && set_nonblock(queue, true) < 0)
+		return -1;
+
+	/* record I/O loop, whose endpoint table we'll use from now on */
+	queue->loop = loop;
+#ifdef HAVE_ZEROCOPY
+	/* start reaping outstanding sends */
+	if (queue->zc_head != queue->zc_next && zc_arm(queue) < 0) {
+		ioevent_detach((struct ioevent *) &queue->zc_error);
+		ioevent_detach((struct ioevent *) &queue->zc_timer);
+		queue->loop = NULL;
+		if (queue->nonblock == 0)
+			set_nonblock(queue, false);
+		return -1;
+	}
 #endif
 
-#ifdef AF_INET6
-		case AF_INET6:
-			from->addrlen = sizeof(struct sockaddr_in6);
-			break;
+	return 0;
+}
+
+static int
+socket_detach(struct ioqueue *q)
+{
+	struct ioqueue_socket *queue = (struct ioqueue_socket *) q;
+
+#ifdef HAVE_ZEROCOPY
+	ioevent_detach((struct ioevent *) &queue->zc_error);
+	ioevent_detach((struct ioevent *) &queue->zc_timer);
 #endif
+	queue->loop = NULL;
 
-#ifdef AF_UNIX
-		case AF_UNIX:
-			from->addrlen = sizeof(struct sockaddr_un);
+	if (queue->nonblock == 0)
+		return set_nonblock(queue, false);
+
+	return 0;
+}
+
+static int
+set_nonblock(struct ioqueue_socket *queue, bool enable)
+{
+	int flags;
+
+	if ((flags = fcntl(queue->sock, F_GETFL)) < 0)
+		return -1;
+
+	flags = enable? flags | O_NONBLOCK : flags & ~O_NONBLOCK;
+
+	return fcntl(queue->sock, F_SETFL, flags);
+}
+
+#ifdef HAVE_ZEROCOPY
+
+static int
+zc_open(struct ioqueue_socket *queue)
+{
+	struct epoll_event epev;
+
+	/* completions only show up as an error condition on the socket,
+	 * which a loop can't wait for by itself, so watch for just that
+	 * in a set of our own and have the loop wait for it to be ready */
+	if ((queue->zc_error.fd = epoll_create1(EPOLL_CLOEXEC)) < 0)
+		return -1;
+
+	memset(&epev, '\0', sizeof(epev));
+	epev.data.fd = queue->sock;
+	if (epoll_ctl(queue->zc_error.fd, EPOLL_CTL_ADD, queue->sock,
+	    &epev) < 0) {
+		close(queue->zc_error.fd);
+		queue->zc_error.fd = -1;
+		return -1;
+	}
+
+	return 0;
+}
+
+static int
+zc_arm(struct ioqueue_socket *queue)
+{
+	struct ioevent *error = (struct ioevent *) &queue->zc_error;
+	struct ioevent *timer = (struct ioevent *) &queue->zc_timer;
+
+	if (queue->loop == NULL)
+		return 0;
+
+	if (!ioevent_attached(error) && ioevent_attach(error, queue->loop) < 0)
+		return -1;
+	if (!ioevent_attached(timer) && ioevent_attach(timer, queue->loop) < 0)
+		return -1;
+
+	return 0;
+}
+
+static void
+zc_disarm(struct ioqueue_socket *queue)
+{
+	/* only wait for completions while there are sends outstanding */
+	if (queue->zc_head != queue->zc_next)
+		return;
+
+	ioevent_detach((struct ioevent *) &queue->zc_error);
+	ioevent_detach((struct ioevent *) &queue->zc_timer);
+}
+
+static size_t
+zc_reap(struct ioqueue_socket *queue)
+{
+	struct msghdr			 msghdr;
+	struct cmsghdr			*cmsg;
+	struct sock_extended_err	 ee;
+	struct zcsend			*send, copy;
+	uint32_t			 id;
+	size_t				 n;
+	union {
+		char			 buf[CMSG_SPACE(sizeof(ee))];
+		struct cmsghdr		 align;
+	}				 control;
+
+	for (n = 0; queue->zc_head != queue->zc_next; ) {
+		/* completions arrive on the error queue */
+		memset(&msghdr, '\0', sizeof(msghdr));
+		msghdr.msg_control = control.buf;
+		msghdr.msg_controllen = sizeof(control.buf);
+		if (recvmsg(queue->sock, &msghdr, MSG_ERRQUEUE | MSG_DONTWAIT) < 0)
 			break;
-#endif
 
-		default:
-			assert(!"can't happen");
+		/* each covers a range of sends */
+		for (cmsg = CMSG_FIRSTHDR(&msghdr); cmsg != NULL;
+		     cmsg = CMSG_NXTHDR(&msghdr, cmsg)) {
+			if (!((cmsg->cmsg_level == SOL_IP &&
+			       cmsg->cmsg_type == IP_RECVERR) ||
+			      (cmsg->cmsg_level == SOL_IPV6 &&
+			       cmsg->cmsg_type == IPV6_RECVERR)))
+				continue;
+
+			memcpy(&ee, CMSG_DATA(cmsg), sizeof(ee));
+			if (ee.ee_errno != 0 ||
+			    ee.ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+				continue;
+
+			/* the callback may send again, and so move things */
+			for (id = ee.ee_info; id - ee.ee_info <=
+			     ee.ee_data - ee.ee_info; id++) {
+				if (id - queue->zc_head >=
+				    queue->zc_next - queue->zc_head)
+					continue;
+
+				send = &queue->zc_sends[id & (queue->zc_cap - 1)];
+				if (send->done)
+					continue;
+				send->done = true;
+				copy = *send;
+
+				copy.cb(ee.ee_code & SO_EE_CODE_ZEROCOPY_COPIED,
+				    copy.arg);
+				n++;
+			}
 		}
 
-		*f = (struct ioendpoint *) from;
-	} else {
-		/* perform the receive */
-		size = readv(queue->sock, iov, nbufs);
+		/* retire completed sends */
+		while (queue->zc_head != queue->zc_next &&
+		       queue->zc_sends[queue->zc_head &
+		       (queue->zc_cap - 1)].done)
+			queue->zc_head++;
 	}
 
+	return n;
+}
+
+static bool
+zc_spurious(struct ioqueue_socket *queue)
+{
+	if (queue->zc_head == queue->zc_next || zc_reap(queue) == 0)
+		return false;
+
+	zc_disarm(queue);
+
+	return socket_nextsize((struct ioqueue *) queue) == 0;
+}
+
+static void
+zc_error(int UNUSED(num), void *arg)
+{
+	struct ioqueue_socket *queue = (struct ioqueue_socket *) arg;
+
+	/* a pending socket error looks just the same, and stays until
+	 * whoever receives picks it up; leave those to the timer */
+	if (zc_reap(queue) == 0)
+		ioevent_detach((struct ioevent *) &queue->zc_error);
+
+	zc_disarm(queue);
+}
+
+static void
+zc_timer(int UNUSED(num), void *arg)
+{
+	struct ioqueue_socket *queue = (struct ioqueue_socket *) arg;
+
+	zc_reap(queue);
+	zc_disarm(queue);
+}
+
+static int
+zc_grow(struct ioqueue_socket *queue)
+{
+	struct zcsend	*sends;
+	size_t		 cap;
+	uint32_t	 id;
+
+	if (queue->zc_next - queue->zc_head < queue->zc_cap)
+		return 0;
+
+	/* sends stay indexed by their id */
+	cap = queue->zc_cap != 0? queue->zc_cap * 2 : 64;
+	sends = malloc(cap * sizeof(*sends));
+	if (sends == NULL)
+		return -1;
+
+	for (id = queue->zc_head; id != queue->zc_next; id++)
+		sends[id & (cap - 1)] =
+		    queue->zc_sends[id & (queue->zc_cap - 1)];
+
+	free(queue->zc_sends);
+	queue->zc_sends = sends;
+	queue->zc_cap = cap;
+
+	return 0;
+}
+
+static ssize_t
+socket_send_zc(struct ioqueue *q, size_t nbufs, const struct iobuf *bufs,
+               struct ioendpoint *t, ioqueue_zc_cb_t *cb, void *arg)
+{
+	struct ioqueue_socket		*queue = (struct ioqueue_socket *) q;
+	struct ioendpoint_socket	*to = NULL, tmp;
+	struct zcsend			*send;
+	struct msghdr			 msghdr;
+	struct iovec			*iov;
+	size_t				 i;
+	ssize_t				 size;
+
+	/* turn zero-copy on when first asked for it */
+	if (queue->zc == 0) {
+		int v = 1;
+
+		queue->zc = setsockopt(queue->sock, SOL_SOCKET, SO_ZEROCOPY,
+		    &v, sizeof(v)) == 0 && zc_open(queue) == 0? 1 : -1;
+	}
+
+	/* the system can't do it, so copy */
+	if (queue->zc < 0) {
+		size = socket_send(q, nbufs, bufs, t);
+		if (size >= 0)
+			cb(true, arg);
+
+		return size;
+	}
+
+	/* pick up completions while we're here, and make room for this one */
+	zc_reap(queue);
+	if (zc_grow(queue) < 0)
+		return -1;
+
+	/* be sure we'll hear of its completion before sending */
+	if (zc_arm(queue) < 0) {
+		zc_disarm(queue);
+		return -1;
+	}
+
+	/* convert endpoint address */
+	if (t != NULL && (to = endpoint_to(t, &tmp)) == NULL) {
+		zc_disarm(queue);
+		return -1;
+	}
+
+	/* convert buffers */
+	iov = alloca(nbufs * sizeof(*iov));
+	for (i = 0; i < nbufs; i++) {
+		iov[i].iov_base = bufs[i].base;
+		iov[i].iov_len = bufs[i].len;
+	}
+
+	/* set up the message header */
+	memset(&msghdr, '\0', sizeof(msghdr));
+	if (to != NULL) {
+		msghdr.msg_name = &to->addr;
+		msghdr.msg_namelen = to->addrlen;
+	}
+	msghdr.msg_iov = iov;
+	msghdr.msg_iovlen = nbufs;
+
+	/* perform the send */
+	size = sendmsg(queue->sock, &msghdr, MSG_ZEROCOPY);
+	endpoint_to_done(t, to);
+	if (size < 0) {
+		if (errno == EMSGSIZE)
+			queue->maxsize = 0;
+		zc_disarm(queue);
+		return -1;
+	}
+
+	/* the kernel numbers successful sends, and so do we */
+	send = &queue->zc_sends[queue->zc_next++ & (queue->zc_cap - 1)];
+	send->cb = cb;
+	send->arg = arg;
+	send->done = false;
+
 	return size;
 }
+#endif /* HAVE_ZEROCOPY */
 
 static struct ioevent *
 socket_send_event(struct ioqueue *q, ioevent_cb_t *cb, void *arg,
@@ -280,6 +1435,45 @@ socket_get(struct ioqueue *q, const struct ioparam *param, uintptr_t *value)
 		return 0;
 	}
 
+	/* get segment size */
+	if (param == &ioqueue_socket_gso) {
+		*value = queue->gso;
+
+		return 0;
+	}
+
+	/* get receive offload mode */
+	if (param == &ioqueue_socket_gro) {
+		*value = queue->gro;
+
+		return 0;
+	}
+
+	/* get non-blocking flag */
+	if (param == &ioqueue_socket_nonblock) {
+		int flags;
+
+		if ((flags = fcntl(queue->sock, F_GETFL)) < 0)
+			return -1;
+		*value = (flags & O_NONBLOCK) != 0;
+
+		return 0;
+	}
+
+	/* get path MTU discovery flag */
+	if (param == &ioqueue_socket_pmtu) {
+		*value = queue->pmtu;
+
+		return 0;
+	}
+
+	/* get segment size of last receive */
+	if (param == &ioqueue_socket_segsize) {
+		*value = queue->segsize;
+
+		return 0;
+	}
+
 	/* get multicast loop flag */
 	if (param == &ioqueue_mcast_loop) {
 		int v;
@@ -359,6 +1553,27 @@ socket_set(struct ioqueue *q, const struct ioparam *param, uintptr_t value)
 		                  &v, sizeof(v));
 	}
 
+	/* set segment size */
+	if (param == &ioqueue_socket_gso)
+		return gso_enable(queue, value);
+
+	/* set receive offload mode */
+	if (param == &ioqueue_socket_gro)
+		return gro_enable(queue, value);
+
+	/* set non-blocking flag, which then sticks */
+	if (param == &ioqueue_socket_nonblock) {
+		if (set_nonblock(queue, value != 0) < 0)
+			return -1;
+		queue->nonblock = value? 1 : -1;
+
+		return 0;
+	}
+
+	/* set path MTU discovery flag */
+	if (param == &ioqueue_socket_pmtu)
+		return pmtu_enable(queue, value != 0);
+
 	/* set V6ONLY flag */
 	if (param == &ioqueue_socket_v6only) {
 		int v = value? 1 : 0;
@@ -510,10 +1725,20 @@ ioqueue_alloc_socket(int af, struct ioendpoint *t, struct ioendpoint *f,
 	/* allocate a new queue and initialise it */
 	queue = calloc(1, sizeof(*queue));
 	if (queue == NULL)
-		return NULL;
+		goto error;
 
 	queue->queue.ops = &socket_ops;
 	queue->af = af;
+#ifdef HAVE_ZEROCOPY
+	ioevent_init((struct ioevent *) &queue->zc_error, IOEVENT_READ,
+	    zc_error, queue, 0);
+	queue->zc_error.fd = -1;
+	ioevent_init((struct ioevent *) &queue->zc_timer, IOEVENT_TIMER,
+	    zc_timer, queue, 0);
+	queue->zc_timer.tv = (struct timeval) {
+		.tv_sec = 0, .tv_usec = ZC_REAP_USEC
+	};
+#endif
 
 	/* create the socket */
 	queue->sock = socket(af, SOCK_DGRAM, 0);
@@ -536,6 +1761,11 @@ ioqueue_alloc_socket(int af, struct ioendpoint *t, struct ioendpoint *f,
 	if (to != NULL &&
 	    connect(queue->sock, (struct sockaddr *) &to->addr, to->addrlen) < 0)
 		goto error;
+	queue->maxsize = 0;
+
+	/* the socket holds on to the addresses */
+	ioendpoint_release((struct ioendpoint *) to);
+	ioendpoint_release((struct ioendpoint *) from);
 
 	return (struct ioqueue *) queue;
 
@@ -0,0 +1,737 @@
+/*
+ * Copyright (c) 2011, Wouter Coene <wouter@irdc.nl>
+ * 
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#include <io/event.h>
+#include <io/queue.h>
+#include <io/socket.h>
+#include "private_socket.h"
+
+#include <alloca.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#define FRAMEHDR	4		/* length prefix, in network order */
+#define MAXFRAME	(1024 * 1024)	/* largest message */
+#define READSZ		(64 * 1024)	/* room to read into at once */
+#define COPYMAX		(4 * 1024)	/* largest message to coalesce */
+#define WBUFMAX		(256 * 1024)	/* coalesced output before pushing back */
+
+#ifndef MSG_NOSIGNAL
+# define MSG_NOSIGNAL	0		/* SO_NOSIGPIPE does it instead */
+#endif
+
+/*
+ * Messages travel over the stream as frames, each holding a message's
+ * length followed by its contents. Small messages are gathered in the
+ * write buffer while attached, and written out together at the end of the
+ * loop iteration; incoming frames are parsed out of reads as large as the
+ * read buffer allows.
+ */
+struct ioqueue_stream {
+	struct ioqueue		 queue;
+	int			 sock;
+	struct ioloop		*loop;		/* I/O loop we're attached to */
+	int			 nonblock;	/* non-blocking: 1 always, -1
+						   never, 0 while attached */
+	struct ioendpoint	*peer;		/* remote endpoint */
+	char			*rbuf;		/* read buffer */
+	size_t			 rcap,		/* size of read buffer */
+				 roff,		/* start of unparsed data */
+				 rlen;		/* end of unparsed data */
+	int			 rerr;		/* error to report once the
+						   read buffer runs dry */
+	char			*wbuf;		/* write buffer */
+	size_t			 wcap,		/* size of write buffer */
+				 woff,		/* start of unwritten data */
+				 wlen;		/* end of unwritten data */
+	struct ioevent		*flush_event,	/* writes at end of iteration */
+				*read_event,	/* fills read buffer */
+				*write_event;	/* writes when socket has room */
+	struct ioflag_list	 send_events,	/* events raised on send_ready */
+				 recv_events;	/* events raised on recv_ready */
+	bool			 send_ready,	/* messages can be sent */
+				 recv_ready;	/* a message can be received */
+};
+
+static int		 stream_done(struct ioqueue *);
+static int		 stream_attach(struct ioqueue *, struct ioloop *);
+static int		 stream_detach(struct ioqueue *);
+static ssize_t		 stream_maxsize(struct ioqueue *);
+static ssize_t		 stream_nextsize(struct ioqueue *);
+static ssize_t		 stream_send(struct ioqueue *, size_t,
+			     const struct iobuf *, struct ioendpoint *);
+static ssize_t		 stream_recv(struct ioqueue *, size_t,
+			     const struct iobuf *, struct ioendpoint **);
+static struct ioevent	*stream_send_event(struct ioqueue *, ioevent_cb_t *,
+			     void *, enum ioevent_opt);
+static struct ioevent	*stream_recv_event(struct ioqueue *, ioevent_cb_t *,
+			     void *, enum ioevent_opt);
+static int		 stream_get(struct ioqueue *, const struct ioparam *,
+			     uintptr_t *);
+static int		 stream_set(struct ioqueue *, const struct ioparam *,
+			     uintptr_t);
+
+static int		 set_nonblock(struct ioqueue_stream *, bool);
+static ssize_t		 frame_next(struct ioqueue_stream *);
+static int		 fill(struct ioqueue_stream *, int);
+static void		 recv_update(struct ioqueue_stream *);
+static int		 flush(struct ioqueue_stream *);
+static void		 wait_writable(struct ioqueue_stream *);
+static int		 wbuf_reserve(struct ioqueue_stream *, size_t);
+static ssize_t		 write_through(struct ioqueue_stream *, uint32_t,
+			     size_t, const struct iobuf *, size_t);
+
+static void		 stream_flush(int, void *);
+static void		 stream_readable(int, void *);
+static void		 stream_writable(int, void *);
+
+static const struct ioqueue_ops
+stream_ops = {
+	.done		= stream_done,
+	.attach		= stream_attach,
+	.detach		= stream_detach,
+	.maxsize	= stream_maxsize,
+	.nextsize	= stream_nextsize,
+	.send		= stream_send,
+	.recv		= stream_recv,
+	.send_event	= stream_send_event,
+	.recv_event	= stream_recv_event,
+	.get		= stream_get,
+	.set		= stream_set
+};
+
+static int
+stream_done(struct ioqueue *q)
+{
+	struct ioqueue_stream *queue = (struct ioqueue_stream *) q;
+
+	/* write out what we can; whatever the socket won't take is lost */
+	flush(queue);
+
+	ioevent_free(queue->flush_event);
+	ioevent_free(queue->read_event);
+	ioevent_free(queue->write_event);
+	ioflag_list_orphan(&queue->send_events);
+	ioflag_list_orphan(&queue->recv_events);
+	ioendpoint_release(queue->peer);
+	free(queue->rbuf);
+	free(queue->wbuf);
+
+	return close(queue->sock);
+}
+
+static int
+stream_attach(struct ioqueue *q, struct ioloop *loop)
+{
+	struct ioqueue_stream *queue = (struct ioqueue_stream *) q;
+
+	/* prevent duplicate attachment */
+	if (queue->loop != NULL) {
+		errno = EBUSY;
+		return -1;
+	}
+
+	if (queue->nonblock == 0 && set_nonblock(queue, true) < 0)
+		return -1;
+
+	/* start filling the read buffer, unless it's got enough already */
+	queue->loop = loop;
+	if (!queue->recv_ready &&
+	    ioevent_attach(queue->read_event, loop) < 0) {
+		queue->loop = NULL;
+		if (queue->nonblock == 0)
+			set_nonblock(queue, false);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int
+stream_detach(struct ioqueue *q)
+{
+	struct ioqueue_stream *queue = (struct ioqueue_stream *) q;
+
+	ioevent_detach(queue->flush_event);
+	ioevent_detach(queue->read_event);
+	ioevent_detach(queue->write_event);
+	queue->loop = NULL;
+
+	if (queue->nonblock == 0 && set_nonblock(queue, false) < 0)
+		return -1;
+
+	/* nothing will write out the buffer for us anymore */
+	return flush(queue);
+}
+
+static ssize_t
+stream_maxsize(struct ioqueue *UNUSED(q))
+{
+	return MAXFRAME;
+}
+
+static ssize_t
+stream_nextsize(struct ioqueue *q)
+{
+	struct ioqueue_stream	*queue = (struct ioqueue_stream *) q;
+	ssize_t			 len;
+
+	/* once the length of a frame is in, that's the size */
+	if ((len = frame_next(queue)) >= 0 || queue->rerr != 0)
+		return len < 0? 0 : len;
+
+	/* otherwise, see if there's more without waiting for it */
+	if (fill(queue, MSG_DONTWAIT) < 0 && errno != EAGAIN &&
+	    errno != EWOULDBLOCK)
+		return -1;
+
+	return (len = frame_next(queue)) < 0? 0 : len;
+}
+
+static ssize_t
+stream_send(struct ioqueue *q, size_t nbufs, const struct iobuf *bufs,
+            struct ioendpoint *to)
+{
+	struct ioqueue_stream	*queue = (struct ioqueue_stream *) q;
+	uint32_t		 hdr;
+	size_t			 i, len;
+	char			*p;
+
+	/* streams only go one way */
+	if (to != NULL && !ioendpoint_equals(to, queue->peer)) {
+		errno = EISCONN;
+		return -1;
+	}
+
+	for (i = len = 0; i < nbufs; i++)
+		len += bufs[i].len;
+	if (len > MAXFRAME) {
+		errno = EMSGSIZE;
+		return -1;
+	}
+	hdr = htonl((uint32_t) len);
+
+	/* large messages, and all of them when there's nobody to write out
+	 * the buffer later, go out right away */
+	if (len > COPYMAX || queue->loop == NULL ||
+	    (!ioevent_attached(queue->flush_event) &&
+	     ioevent_attach(queue->flush_event, queue->loop) < 0))
+		return write_through(queue, hdr, nbufs, bufs, len);
+
+	/* make room, pushing back if the socket isn't keeping up */
+	if (queue->wlen - queue->woff + FRAMEHDR + len > WBUFMAX &&
+	    flush(queue) < 0) {
+		if (errno == EAGAIN || errno == EWOULDBLOCK) {
+			queue->send_ready = false;
+			errno = EAGAIN;
+		}
+		return -1;
+	}
+	if (wbuf_reserve(queue, FRAMEHDR + len) < 0)
+		return -1;
+
+	/* append the frame */
+	p = queue->wbuf + queue->wlen;
+	memcpy(p, &hdr, FRAMEHDR);
+	for (p += FRAMEHDR, i = 0; i < nbufs; p += bufs[i++].len)
+		memcpy(p, bufs[i].base, bufs[i].len);
+	queue->wlen += FRAMEHDR + len;
+
+	/* sent from outside the loop's dispatch, so it won't run deferred
+	 * events by itself */
+	if (!queue->loop->running)
+		ioevent_queue(queue->flush_event);
+
+	return len;
+}
+
+static ssize_t
+stream_recv(struct ioqueue *q, size_t nbufs, const struct iobuf *bufs,
+            struct ioendpoint **f)
+{
+	struct ioqueue_stream	*queue = (struct ioqueue_stream *) q;
+	ssize_t			 len;
+	size_t			 i, n, done;
+	char			*p;
+
+	/* wait for a complete frame */
+	while ((len = frame_next(queue)) < 0 ||
+	       queue->rlen - queue->roff < FRAMEHDR + (size_t) len) {
+		if (queue->rerr != 0) {
+			errno = queue->rerr;
+			return -1;
+		}
+
+		if (fill(queue, 0) < 0)
+			return -1;
+	}
+
+	/* copy out as much of it as fits */
+	p = queue->rbuf + queue->roff + FRAMEHDR;
+	for (i = done = 0; i < nbufs && done < (size_t) len; i++) {
+		n = min(bufs[i].len, (size_t) len - done);
+		memcpy(bufs[i].base, p + done, n);
+		done += n;
+	}
+	queue->roff += FRAMEHDR + len;
+
+	if (f != NULL)
+		*f = ioendpoint_retain(queue->peer);
+
+	recv_update(queue);
+
+	return done;
+}
+
+static struct ioevent *
+stream_send_event(struct ioqueue *q, ioevent_cb_t *cb, void *arg,
+                  enum ioevent_opt opt)
+{
+	struct ioqueue_stream *queue = (struct ioqueue_stream *) q;
+
+	return ioevent_flag_owned(&queue->send_events, &queue->send_ready,
+	    cb, arg, opt);
+}
+
+static struct ioevent *
+stream_recv_event(struct ioqueue *q, ioevent_cb_t *cb, void *arg,
+                  enum ioevent_opt opt)
+{
+	struct ioqueue_stream *queue = (struct ioqueue_stream *) q;
+
+	return ioevent_flag_owned(&queue->recv_events, &queue->recv_ready,
+	    cb, arg, opt);
+}
+
+static int
+stream_get(struct ioqueue *q, const struct ioparam *param, uintptr_t *value)
+{
+	struct ioqueue_stream *queue = (struct ioqueue_stream *) q;
+
+	/* get non-blocking flag */
+	if (param == &ioqueue_socket_nonblock) {
+		int flags;
+
+		if ((flags = fcntl(queue->sock, F_GETFL)) < 0)
+			return -1;
+		*value = (flags & O_NONBLOCK) != 0;
+
+		return 0;
+	}
+
+	errno = ENOTSUP;
+
+	return -1;
+}
+
+static int
+stream_set(struct ioqueue *q, const struct ioparam *param, uintptr_t value)
+{
+	struct ioqueue_stream *queue = (struct ioqueue_stream *) q;
+
+	/* set non-blocking flag, which then sticks */
+	if (param == &ioqueue_socket_nonblock) {
+		if (set_nonblock(queue, value != 0) < 0)
+			return -1;
+		queue->nonblock = value? 1 : -1;
+
+		return 0;
+	}
+
+	errno = ENOTSUP;
+
+	return -1;
+}
+
+static int
+set_nonblock(struct ioqueue_stream *queue, bool enable)
+{
+	int flags;
+
+	if ((flags = fcntl(queue->sock, F_GETFL)) < 0)
+		return -1;
+
+	flags = enable? flags | O_NONBLOCK : flags & ~O_NONBLOCK;
+
+	return fcntl(queue->sock, F_SETFL, flags);
+}
+
+static ssize_t
+frame_next(struct ioqueue_stream *queue)
+{
+	uint32_t hdr;
+
+	if (queue->rlen - queue->roff < FRAMEHDR)
+		return -1;
+
+	memcpy(&hdr, queue->rbuf + queue->roff, FRAMEHDR);
+
+	return ntohl(hdr);
+}
+
+static int
+fill(struct ioqueue_stream *queue, int flags)
+{
+	ssize_t	len, size;
+	size_t	need;
+	char	*p;
+
+	/* make sure the frame we're in the middle of fits */
+	need = READSZ;
+	if ((len = frame_next(queue)) >= 0) {
+		if (len > MAXFRAME) {
+			queue->rerr = EPROTO;
+			errno = EPROTO;
+			return -1;
+		}
+		need = max(need, FRAMEHDR + (size_t) len);
+	}
+
+	/* move what's left to the front, and grow if that's not enough */
+	if (queue->roff > 0) {
+		memmove(queue->rbuf, queue->rbuf + queue->roff,
+		    queue->rlen - queue->roff);
+		queue->rlen -= queue->roff;
+		queue->roff = 0;
+	}
+
+	if (queue->rcap < need) {
+		if ((p = realloc(queue->rbuf, need)) == NULL)
+			return -1;
+
+		queue->rbuf = p;
+		queue->rcap = need;
+	}
+
+	/* read as much as we can get */
+	size = recv(queue->sock, queue->rbuf + queue->rlen,
+	    queue->rcap - queue->rlen, flags);
+	if (size < 0)
+		return -1;
+
+	/* the peer is done; messages it sent before still count */
+	if (size == 0) {
+		queue->rerr = queue->rlen > 0? EPROTO : ECONNRESET;
+		errno = queue->rerr;
+		return -1;
+	}
+
+	queue->rlen += size;
+
+	return 0;
+}
+
+static void
+recv_update(struct ioqueue_stream *queue)
+{
+	ssize_t len;
+
+	/* another complete frame, or an error to report, keeps us ready */
+	len = frame_next(queue);
+	if ((len >= 0 && queue->rlen - queue->roff >= FRAMEHDR + (size_t) len) ||
+	    queue->rerr != 0) {
+		queue->recv_ready = true;
+		ioflag_list_raise(&queue->recv_events);
+		ioevent_detach(queue->read_event);
+		return;
+	}
+
+	/* otherwise, the socket has to tell us */
+	queue->recv_ready = false;
+	if (queue->loop != NULL && !ioevent_attached(queue->read_event))
+		ioevent_attach(queue->read_event, queue->loop);
+}
+
+static int
+flush(struct ioqueue_stream *queue)
+{
+	ssize_t size;
+
+	while (queue->woff < queue->wlen) {
+		size = send(queue->sock, queue->wbuf + queue->woff,
+		    queue->wlen - queue->woff, MSG_NOSIGNAL);
+		if (size < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				wait_writable(queue);
+			return -1;
+		}
+
+		queue->woff += size;
+	}
+
+	queue->woff = queue->wlen = 0;
+	ioevent_detach(queue->write_event);
+
+	/* room again for those we pushed back */
+	if (!queue->send_ready) {
+		queue->send_ready = true;
+		ioflag_list_raise(&queue->send_events);
+	}
+
+	return 0;
+}
+
+static void
+wait_writable(struct ioqueue_stream *queue)
+{
+	/* have the socket tell us when it has room */
+	if (queue->loop != NULL && !ioevent_attached(queue->write_event))
+		ioevent_attach(queue->write_event, queue->loop);
+}
+
+static int
+wbuf_reserve(struct ioqueue_stream *queue, size_t len)
+{
+	size_t	 cap;
+	char	*p;
+
+	/* move what's left to the front, and grow if that's not enough */
+	if (queue->woff > 0) {
+		memmove(queue->wbuf, queue->wbuf + queue->woff,
+		    queue->wlen - queue->woff);
+		queue->wlen -= queue->woff;
+		queue->woff = 0;
+	}
+
+	if (queue->wlen + len <= queue->wcap)
+		return 0;
+
+	for (cap = max(queue->wcap, READSZ); cap < queue->wlen + len; cap *= 2)
+		;
+	if ((p = realloc(queue->wbuf, cap)) == NULL)
+		return -1;
+
+	queue->wbuf = p;
+	queue->wcap = cap;
+
+	return 0;
+}
+
+static ssize_t
+write_through(struct ioqueue_stream *queue, uint32_t hdr, size_t nbufs,
+              const struct iobuf *bufs, size_t len)
+{
+	struct msghdr	 msghdr;
+	struct iovec	*iov;
+	size_t		 i, n, pending, done, skip;
+	ssize_t		 size;
+	char		*p;
+
+	/* write out anything pending, the frame header and its contents
+	 * all at once */
+	memset(&msghdr, '\0', sizeof(msghdr));
+	pending = queue->wlen - queue->woff;
+	iov = alloca((nbufs + 2) * sizeof(*iov));
+	n = 0;
+	if (pending > 0) {
+		iov[n].iov_base = queue->wbuf + queue->woff;
+		iov[n++].iov_len = pending;
+	}
+	iov[n].iov_base = &hdr;
+	iov[n++].iov_len = FRAMEHDR;
+	for (i = 0; i < nbufs; i++) {
+		iov[n].iov_base = bufs[i].base;
+		iov[n++].iov_len = bufs[i].len;
+	}
+
+	for (done = 0; done < pending + FRAMEHDR + len; done += size) {
+		msghdr.msg_iov = iov;
+		msghdr.msg_iovlen = n;
+		size = sendmsg(queue->sock, &msghdr, MSG_NOSIGNAL);
+		if (size < 0) {
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+				return -1;
+
+			/* if the frame hasn't started, push back */
+			if (done <= pending) {
+				queue->woff += done;
+				wait_writable(queue);
+				queue->send_ready = false;
+				errno = EAGAIN;
+				return -1;
+			}
+			break;
+		}
+
+		/* skip past what was written */
+		for (skip = size; n > 0 && skip >= iov[0].iov_len; n--) {
+			skip -= iov[0].iov_len;
+			iov++;
+		}
+		if (n > 0) {
+			iov[0].iov_base = (char *) iov[0].iov_base + skip;
+			iov[0].iov_len -= skip;
+		}
+	}
+
+	/* all of it made it */
+	if (done == pending + FRAMEHDR + len) {
+		queue->woff = queue->wlen = 0;
+		return len;
+	}
+
+	/* the frame has started, so the rest of it has to follow; keep it
+	 * until the socket has room */
+	queue->woff = queue->wlen = 0;
+	if (wbuf_reserve(queue, pending + FRAMEHDR + len - done) < 0)
+		return -1;
+
+	for (p = queue->wbuf, i = 0; i < n; p += iov[i++].iov_len)
+		memcpy(p, iov[i].iov_base, iov[i].iov_len);
+	queue->wlen = p - queue->wbuf;
+	wait_writable(queue);
+
+	return len;
+}
+
+static void
+stream_flush(int UNUSED(num), void *arg)
+{
+	struct ioqueue_stream *queue = (struct ioqueue_stream *) arg;
+
+	/* once per iteration is all it takes */
+	ioevent_detach(queue->flush_event);
+	flush(queue);
+}
+
+static void
+stream_readable(int UNUSED(num), void *arg)
+{
+	struct ioqueue_stream *queue = (struct ioqueue_stream *) arg;
+
+	if (fill(queue, MSG_DONTWAIT) < 0 && queue->rerr == 0)
+		return;
+
+	recv_update(queue);
+}
+
+static void
+stream_writable(int UNUSED(num), void *arg)
+{
+	struct ioqueue_stream *queue = (struct ioqueue_stream *) arg;
+
+	flush(queue);
+}
+
+struct ioqueue *
+ioqueue_stream_wrap(int sock, struct ioendpoint *peer)
+{
+	struct ioqueue_stream	*queue;
+	int			 v;
+
+	/* allocate a new queue and initialise it */
+	queue = calloc(1, sizeof(*queue));
+	if (queue == NULL)
+		return NULL;
+
+	queue->queue.ops = &stream_ops;
+	queue->sock = sock;
+	queue->send_ready = true;
+
+	queue->flush_event = ioevent_defer(stream_flush, queue, 0);
+	queue->read_event = ioevent_read(sock, stream_readable, queue, 0);
+	queue->write_event = ioevent_write(sock, stream_writable, queue, 0);
+	if (queue->flush_event == NULL || queue->read_event == NULL ||
+	    queue->write_event == NULL) {
+		if (queue->flush_event != NULL)
+			ioevent_free(queue->flush_event);
+		if (queue->read_event != NULL)
+			ioevent_free(queue->read_event);
+		if (queue->write_event != NULL)
+			ioevent_free(queue->write_event);
+		free(queue);
+		return NULL;
+	}
+
+	/* we do our own coalescing, so don't have the system hold back
+	 * small writes as well */
+	v = 1;
+	setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &v, sizeof(v));
+
+	/* a peer that goes away mustn't take the process with it */
+#ifdef SO_NOSIGPIPE
+	setsockopt(sock, SOL_SOCKET, SO_NOSIGPIPE, &v, sizeof(v));
+#endif
+
+	queue->peer = peer;
+
+	return (struct ioqueue *) queue;
+}
+
+struct ioqueue *
+ioqueue_alloc_stream(struct ioendpoint *t, const struct ioparam_init *inits,
+                     size_t ninits)
+{
+	struct ioqueue			*queue;
+	struct ioendpoint_socket	*to;
+	size_t				 i;
+	bool				 nonblock;
+	int				 sock, e;
+
+	/* convert endpoint to something we can deal with */
+	to = (struct ioendpoint_socket *)
+	    ioendpoint_convert(t, &ioendpoint_socket_ops);
+	if (to == NULL) {
+		errno = EAFNOSUPPORT;
+		return NULL;
+	}
+
+	/* create the socket and the queue around it */
+	sock = socket(to->addr.ss_family, SOCK_STREAM, 0);
+	if (sock < 0) {
+		ioendpoint_release((struct ioendpoint *) to);
+		return NULL;
+	}
+
+	queue = ioqueue_stream_wrap(sock, (struct ioendpoint *) to);
+	if (queue == NULL) {
+		close(sock);
+		ioendpoint_release((struct ioendpoint *) to);
+		return NULL;
+	}
+
+	/* process all initialisation parameters */
+	for (i = 0; i < ninits; i++) {
+		if (ioqueue_set(queue, inits[i].param, inits[i].value) < 0)
+			goto error;
+	}
+
+	/* connect to the remote endpoint; that waits for the connection
+	 * even if the queue is to be non-blocking afterwards */
+	nonblock = ((struct ioqueue_stream *) queue)->nonblock > 0;
+	if ((nonblock && set_nonblock((struct ioqueue_stream *) queue,
+	    false) < 0) ||
+	    connect(sock, (struct sockaddr *) &to->addr, to->addrlen) < 0 ||
+	    (nonblock && set_nonblock((struct ioqueue_stream *) queue,
+	    true) < 0))
+		goto error;
+
+	return queue;
+
+error:
+	e = errno;
+	ioqueue_free(queue);
+	errno = e;
+
+	return NULL;
+}
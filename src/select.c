@@ -45,6 +45,7 @@ static void	 done(struct ioloop *);
 static int	 attach(struct ioloop *, struct ioevent *);
 static int	 detach(struct ioloop *, struct ioevent *);
 static int	 go(struct ioloop *, const struct timeval *);
+static unsigned int array_size(unsigned int, unsigned int, unsigned int);
 
 const struct iobackend
 iobackend_select = {
@@ -84,45 +85,44 @@ done(struct ioloop *loop)
 	}
 
 	/* release arrays */
-	free(sel->readev);
-	free(sel->writeev);
-	free(sel->readset);
-	free(sel->readset_out);
-	free(sel->writeset);
-	free(sel->writeset_out);
+	iomem_free(loop, sel->readev, array_size(sel->capacity, 1, sizeof(struct ioevent_fd *)));
+	iomem_free(loop, sel->writeev, array_size(sel->capacity, 1, sizeof(struct ioevent_fd *)));
+	iomem_free(loop, sel->readset, array_size(sel->capacity, NFDBITS, sizeof(fd_mask)));
+	iomem_free(loop, sel->readset_out, array_size(sel->capacity, NFDBITS, sizeof(fd_mask)));
+	iomem_free(loop, sel->writeset, array_size(sel->capacity, NFDBITS, sizeof(fd_mask)));
+	iomem_free(loop, sel->writeset_out, array_size(sel->capacity, NFDBITS, sizeof(fd_mask)));
+}
+
+static unsigned int
+array_size(unsigned int sz, unsigned int div, unsigned int mul)
+{
+	if (div != 1)
+		sz = (sz + div - 1) / div;
+
+	return sz * mul;
 }
 
 static int
-resize_array(void **ptr, unsigned int oldsz, unsigned int newsz,
-             unsigned int div, unsigned int mul)
+resize_array(struct ioloop *loop, void **ptr, unsigned int oldsz,
+             unsigned int newsz, unsigned int div, unsigned int mul)
 {
 	unsigned int o, n;
 	void *new;
 
-	/* calculate the old size */
-	if (div != 1)
-		o = (oldsz + div - 1) / div;
-	else
-		o = oldsz;
-	o *= mul;
-
-	/* calculate the new size */
-	if (div != 1)
-		n = (newsz + div - 1) / div;
-	else
-		n = newsz;
-	n *= mul;
+	/* calculate the old and new sizes */
+	o = array_size(oldsz, div, mul);
+	n = array_size(newsz, div, mul);
 
 	/* does it change? */
 	if (o != n) {
 		/* resize the array */
-		if ((new = realloc(*ptr, n)) == NULL)
+		if ((new = iomem_realloc(loop, *ptr, o, n)) == NULL)
 			return -1;
 		*ptr = new;
 	}
 
 	/* clear out the new area, which is uninitialised */
-	memset((char *) new + o, '\0', n - o);
+	memset((char *) *ptr + o, '\0', n - o);
 
 	return 0;
 }
@@ -140,12 +140,12 @@ resize(struct ioloop_select *sel, int fd)
 		newsz *= 2;
 
 	/* resize everything */
-	if (resize_array((void **) &sel->readev, sel->capacity, newsz, 1, sizeof(struct ioevent_fd *)) < 0 ||
-	    resize_array((void **) &sel->writeev, sel->capacity, newsz, 1, sizeof(struct ioevent_fd *)) < 0 ||
-	    resize_array((void **) &sel->readset, sel->capacity, newsz, NFDBITS, sizeof(fd_mask)) < 0 ||
-	    resize_array((void **) &sel->readset_out, sel->capacity, newsz, NFDBITS, sizeof(fd_mask)) < 0 ||
-	    resize_array((void **) &sel->writeset, sel->capacity, newsz, NFDBITS, sizeof(fd_mask)) < 0 ||
-	    resize_array((void **) &sel->writeset_out, sel->capacity, newsz, NFDBITS, sizeof(fd_mask)) < 0)
+	if (resize_array(&sel->loop, (void **) &sel->readev, sel->capacity, newsz, 1, sizeof(struct ioevent_fd *)) < 0 ||
+	    resize_array(&sel->loop, (void **) &sel->writeev, sel->capacity, newsz, 1, sizeof(struct ioevent_fd *)) < 0 ||
+	    resize_array(&sel->loop, (void **) &sel->readset, sel->capacity, newsz, NFDBITS, sizeof(fd_mask)) < 0 ||
+	    resize_array(&sel->loop, (void **) &sel->readset_out, sel->capacity, newsz, NFDBITS, sizeof(fd_mask)) < 0 ||
+	    resize_array(&sel->loop, (void **) &sel->writeset, sel->capacity, newsz, NFDBITS, sizeof(fd_mask)) < 0 ||
+	    resize_array(&sel->loop, (void **) &sel->writeset_out, sel->capacity, newsz, NFDBITS, sizeof(fd_mask)) < 0)
 		return -1;
 
 	/* and we're done */
@@ -226,11 +226,10 @@ detach(struct ioloop *loop, struct ioevent *event)
 
 	/* update largest fd */
 	if (evf->fd == sel->maxfd) {
-		do
-			sel->maxfd--;
 		while (sel->maxfd >= 0 &&
 		       sel->readev[sel->maxfd] == NULL &&
-		       sel->writeev[sel->maxfd] == NULL);
+		       sel->writeev[sel->maxfd] == NULL)
+			sel->maxfd--;
 	}
 
 	return 0;